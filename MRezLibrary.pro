@@ -1,7 +1,8 @@
 TEMPLATE = app
 CONFIG += c++14
 CONFIG -= app_bundle
-QMAKE_CXXFLAGS += -O3
+CONFIG += thread
+QMAKE_CXXFLAGS += -O3 -march=native
 QMAKE_CFLAGS_RELEASE    = -O3
 
 INCLUDEPATH += ./include/
@@ -15,12 +16,25 @@ HEADERS += \
     include/humanize/format_int.h \
     include/humanize/numbers.h \
     include/math/matrix.h \
+    include/math/simd.h \
+    include/math/vector_soa.h \
+    include/math/dense_matrix.h \
+    include/math/quaternion.h \
+    include/math/fast_math.h \
+    include/math/segments.h \
     include/humanize/time.h \
     include/math/math.h \
     include/misc./color.h \
     include/misc./string_utils.h \
     include/misc./log.h \
     include/misc./rng.h \
+    include/misc./rng_engines.h \
     include/misc./array_util.h \
     include/misc./monte_carlo.h \
-    include/network/net.h
+    include/misc./sampling.h \
+    include/misc./simd_rng.h \
+    include/network/net.h \
+    include/network/packet_pool.h \
+    include/network/reactor.h \
+    include/network/server.h \
+    include/network/uring.h
@@ -0,0 +1,249 @@
+#ifndef DENSE_MATRIX_H
+#define DENSE_MATRIX_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "matrix.h"
+
+// Heap-allocated matrix with run-time dimensions. Stored column-major like
+// Matrix, element (row, col) at data()[row + col*rows()], in 64-byte
+// aligned memory.
+template<typename T = float>
+class DenseMatrix {
+public:
+    DenseMatrix() = default;
+
+    DenseMatrix(std::size_t rows, std::size_t cols, T value = T(0))
+        : rows_(rows), cols_(cols), data_(rows * cols, value)
+    {
+    }
+
+    // Conversion from and to the fixed-size Matrix
+    template<int r, int c>
+    explicit DenseMatrix(const Matrix<r, c, T>& m)
+        : DenseMatrix(r, c)
+    {
+        std::copy(m.data, m.data + r*c, data_.begin());
+    }
+
+    template<int r, int c>
+    Matrix<r, c, T> toMatrix() const {
+        assert(rows_ == (std::size_t)r && cols_ == (std::size_t)c);
+        Matrix<r, c, T> m;
+        std::copy(data_.begin(), data_.end(), m.data);
+        return m;
+    }
+
+    static DenseMatrix identity(std::size_t n) {
+        DenseMatrix m(n, n);
+        for(std::size_t i = 0; i < n; ++i) m(i, i) = T(1);
+        return m;
+    }
+
+    std::size_t rows() const { return rows_; }
+    std::size_t cols() const { return cols_; }
+    std::size_t size() const { return data_.size(); }
+
+    T* data() { return data_.data(); }
+    const T* data() const { return data_.data(); }
+
+    T& operator()(std::size_t row, std::size_t col) { return data_[row + col*rows_]; }
+    const T& operator()(std::size_t row, std::size_t col) const { return data_[row + col*rows_]; }
+
+    // Resizes to rows x cols with every element set to 'value'
+    void assign(std::size_t rows, std::size_t cols, T value = T(0)) {
+        rows_ = rows;
+        cols_ = cols;
+        data_.assign(rows * cols, value);
+    }
+
+private:
+    std::size_t rows_ = 0, cols_ = 0;
+    std::vector<T, AlignedAllocator<T>> data_;
+};
+
+namespace gemm_detail {
+
+// Register tile and cache blocks. The micro-kernel keeps an mr x nr tile of
+// C in registers (mr = two vectors); a kc x nr panel of B stays in L1, an
+// mc x kc block of A in L2 and a kc x nc panel of B in L3.
+template<typename T>
+struct Blocking {
+    using Ops = simd::Wide<T>;
+    static constexpr int mr = Ops::width == 1 ? 4 : 2 * Ops::width;
+    // AVX-512 has 32 vector registers: 24 accumulators, otherwise 12 of 16
+    static constexpr int nr = Ops::width == 1 ? 4 : (Ops::width * sizeof(T) == 64 ? 12 : 6);
+    static constexpr std::size_t kc = 256;
+    static constexpr std::size_t mc = (256 * 1024 / (kc * sizeof(T))) / mr * mr > (std::size_t)mr
+                                    ? (256 * 1024 / (kc * sizeof(T))) / mr * mr : mr;
+    static constexpr std::size_t nc = 4096;
+};
+
+inline std::size_t roundUp(std::size_t x, std::size_t multiple) { return (x + multiple - 1) / multiple * multiple; }
+
+// Copies rows [0, m) x columns [0, k) of column-major 'a' into panels of mr
+// rows, each stored k-major (a[p*mr + i]). Missing rows are zero-padded.
+template<typename T>
+void packA(const T* a, std::size_t lda, std::size_t m, std::size_t k, T* out) {
+    constexpr int mr = Blocking<T>::mr;
+    for(std::size_t ir = 0; ir < m; ir += mr) {
+        const std::size_t rows = std::min<std::size_t>(mr, m - ir);
+        for(std::size_t p = 0; p < k; ++p, out += mr) {
+            const T* col = a + ir + p*lda;
+            std::size_t i = 0;
+            for(; i < rows; ++i) out[i] = col[i];
+            for(; i < (std::size_t)mr; ++i) out[i] = T(0);
+        }
+    }
+}
+
+// Copies rows [0, k) x columns [0, n) of column-major 'b' into panels of nr
+// columns, each stored k-major (b[p*nr + j]). Missing columns are zero-padded.
+template<typename T>
+void packB(const T* b, std::size_t ldb, std::size_t k, std::size_t n, T* out) {
+    constexpr int nr = Blocking<T>::nr;
+    for(std::size_t jr = 0; jr < n; jr += nr) {
+        const std::size_t cols = std::min<std::size_t>(nr, n - jr);
+        for(std::size_t p = 0; p < k; ++p, out += nr) {
+            std::size_t j = 0;
+            for(; j < cols; ++j) out[j] = b[p + (jr + j)*ldb];
+            for(; j < (std::size_t)nr; ++j) out[j] = T(0);
+        }
+    }
+}
+
+// C[0..m, 0..n] += alpha * A_panel * B_panel for one mr x nr tile
+template<typename T>
+void microKernel(std::size_t k, const T* a, const T* b, T alpha, T* c, std::size_t ldc, int m, int n) {
+    using B = Blocking<T>;
+    using Ops = typename B::Ops;
+    using V = typename Ops::type;
+    constexpr int vr = B::mr / Ops::width;
+
+    V acc[B::nr][vr];
+    for(int j = 0; j < B::nr; ++j)
+        for(int v = 0; v < vr; ++v) acc[j][v] = Ops::set1(T(0));
+
+    for(std::size_t p = 0; p < k; ++p, a += B::mr, b += B::nr) {
+        V av[vr];
+        for(int v = 0; v < vr; ++v) av[v] = Ops::load(a + v*Ops::width);
+        for(int j = 0; j < B::nr; ++j) {
+            const V bj = Ops::set1(b[j]);
+            for(int v = 0; v < vr; ++v) acc[j][v] = Ops::madd(av[v], bj, acc[j][v]);
+        }
+    }
+
+    const V va = Ops::set1(alpha);
+    if(m == B::mr && n == B::nr) {
+        for(int j = 0; j < B::nr; ++j)
+            for(int v = 0; v < vr; ++v) {
+                T* cp = c + j*ldc + v*Ops::width;
+                Ops::storeu(cp, Ops::madd(acc[j][v], va, Ops::loadu(cp)));
+            }
+        return;
+    }
+
+    // edge tile: only part of it lies inside C
+    alignas(64) T tile[B::nr][B::mr];
+    for(int j = 0; j < B::nr; ++j)
+        for(int v = 0; v < vr; ++v) Ops::store(&tile[j][v*Ops::width], acc[j][v]);
+    for(int j = 0; j < n; ++j)
+        for(int i = 0; i < m; ++i) c[i + j*ldc] += alpha * tile[j][i];
+}
+
+} //namespace gemm_detail
+
+// c = alpha * a * b + beta * c, with 'threads' workers (0 = one per core).
+// Blocked after Goto/BLIS: panels of b and blocks of a are packed into
+// contiguous buffers sized for the caches and multiplied by a register-tiled
+// SIMD micro-kernel; the blocks of rows of c are shared out among the
+// threads. c must not alias a or b.
+template<typename T>
+void gemm(T alpha, const DenseMatrix<T>& a, const DenseMatrix<T>& b, T beta, DenseMatrix<T>& c,
+          unsigned threads = 0) {
+    namespace gd = gemm_detail;
+    using Bk = gd::Blocking<T>;
+    assert(a.cols() == b.rows() && c.rows() == a.rows() && c.cols() == b.cols());
+    assert(&c != &a && &c != &b);
+
+    const std::size_t m = a.rows(), n = b.cols(), k = a.cols();
+    if(beta == T(0)) std::fill(c.data(), c.data() + c.size(), T(0));
+    else if(beta != T(1)) for(std::size_t i = 0; i < c.size(); ++i) c.data()[i] *= beta;
+    if(m == 0 || n == 0 || k == 0) return;
+
+    if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    // smaller row blocks when there are fewer blocks than threads
+    const std::size_t mc = std::min(Bk::mc, gd::roundUp((m + threads - 1) / threads, Bk::mr));
+    const std::size_t blocks = (m + mc - 1) / mc;
+    threads = (unsigned)std::min<std::size_t>(threads, blocks);
+
+    std::vector<T, AlignedAllocator<T>> packed_b(gd::roundUp(std::min(Bk::nc, n), Bk::nr) * Bk::kc);
+    std::vector<std::vector<T, AlignedAllocator<T>>> packed_a(threads, std::vector<T, AlignedAllocator<T>>(mc * Bk::kc));
+
+    for(std::size_t jc = 0; jc < n; jc += Bk::nc) {
+        const std::size_t nc = std::min(Bk::nc, n - jc);
+        for(std::size_t pc = 0; pc < k; pc += Bk::kc) {
+            const std::size_t kc = std::min(Bk::kc, k - pc);
+            gd::packB(b.data() + pc + jc*b.rows(), b.rows(), kc, nc, packed_b.data());
+
+            std::atomic<std::size_t> next_block(0);
+            auto worker = [&](unsigned t) {
+                T* pa = packed_a[t].data();
+                for(std::size_t blk = next_block++; blk < blocks; blk = next_block++) {
+                    const std::size_t ic = blk * mc, mb = std::min(mc, m - ic);
+                    gd::packA(a.data() + ic + pc*a.rows(), a.rows(), mb, kc, pa);
+
+                    for(std::size_t jr = 0; jr < nc; jr += Bk::nr)
+                        for(std::size_t ir = 0; ir < mb; ir += Bk::mr)
+                            gd::microKernel(kc, pa + ir*kc, packed_b.data() + jr*kc, alpha,
+                                            c.data() + (ic + ir) + (jc + jr)*c.rows(), c.rows(),
+                                            (int)std::min<std::size_t>(Bk::mr, mb - ir),
+                                            (int)std::min<std::size_t>(Bk::nr, nc - jr));
+                }
+            };
+
+            std::vector<std::thread> pool;
+            for(unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+            worker(0);
+            for(auto& t : pool) t.join();
+        }
+    }
+}
+
+template<typename T>
+DenseMatrix<T> operator*(const DenseMatrix<T>& a, const DenseMatrix<T>& b) {
+    DenseMatrix<T> c(a.rows(), b.cols());
+    gemm(T(1), a, b, T(0), c);
+    return c;
+}
+
+template<typename T>
+DenseMatrix<T> operator+(const DenseMatrix<T>& a, const DenseMatrix<T>& b) {
+    assert(a.rows() == b.rows() && a.cols() == b.cols());
+    DenseMatrix<T> result(a.rows(), a.cols());
+    for(std::size_t i = 0; i < a.size(); ++i) result.data()[i] = a.data()[i] + b.data()[i];
+    return result;
+}
+
+template<typename T>
+DenseMatrix<T> operator-(const DenseMatrix<T>& a, const DenseMatrix<T>& b) {
+    assert(a.rows() == b.rows() && a.cols() == b.cols());
+    DenseMatrix<T> result(a.rows(), a.cols());
+    for(std::size_t i = 0; i < a.size(); ++i) result.data()[i] = a.data()[i] - b.data()[i];
+    return result;
+}
+
+template<typename T>
+DenseMatrix<T> m_transpose(const DenseMatrix<T>& m) {
+    DenseMatrix<T> result(m.cols(), m.rows());
+    for(std::size_t col = 0; col < m.cols(); ++col)
+        for(std::size_t row = 0; row < m.rows(); ++row) result(col, row) = m(row, col);
+    return result;
+}
+
+#endif // DENSE_MATRIX_H
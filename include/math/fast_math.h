@@ -0,0 +1,291 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <cmath>
+#include <cstddef>
+
+#include "simd.h"
+
+// Branch-free polynomial sin, cos, sincos, exp, log and atan2 for float.
+// They are written once against the simd::Wide / simd::Scalar interface, so
+// the same code runs on one float or on a full vector (4 lanes SSE/NEON, 8
+// AVX, 16 AVX-512):
+//
+//     simd::sin<simd::Wide<float>>(v)                          // a vector
+//     Math::fastSin(x)                                         // one float
+//     Math::fastSin(in, out, count)                            // an array
+//     Math::fastExp<simd::Accuracy::Fast>(in, out, count)
+//
+// Each function has two accuracy tiers. Max errors against a correctly
+// rounded result, measured on dense samples of the ranges given:
+//
+//               Precise                Fast
+//   sin, cos    2.4 ulp  |x| <= 8192   1.5e-6 abs  |x| <= 8192
+//   exp         1.3 ulp                8.5 ulp
+//   log         1.2 ulp                25 ulp
+//   atan2       3.2 ulp                11 ulp
+//
+// Beyond |x| = 8192 sin and cos lose accuracy steadily without FMA.
+// exp gives 0 below -103.9 (denormals from -87.3) and +inf above 88.72.
+// log gives -inf at 0 and NaN below 0; it handles denormals. atan2 expects
+// finite inputs and gives 0 for (0, 0). NaN inputs give unspecified results.
+
+namespace simd {
+
+enum class Accuracy { Fast, Precise };
+
+namespace math_detail {
+
+// c0 + x*(c1 + x*(c2 + ...))
+template<typename Ops, typename V>
+V horner(V, float c) { return Ops::set1(c); }
+
+template<typename Ops, typename V, typename... C>
+V horner(V x, float c0, C... c) { return Ops::madd(horner<Ops>(x, c...), x, Ops::set1(c0)); }
+
+template<typename Ops, typename V>
+V negate(V a) { return Ops::sub(Ops::set1(0.0f), a); }
+
+// a * 2^n for integral n in [-252, 254], in two steps so that results near
+// the ends of the float range neither overflow nor flush early
+template<typename Ops, typename V>
+V ldexp(V a, V n) {
+    const V h = Ops::round(Ops::sub(Ops::mul(n, Ops::set1(0.5f)), Ops::set1(0.25f))); // floor(n / 2)
+    return Ops::mul(Ops::mul(a, Ops::pow2(h)), Ops::pow2(Ops::sub(n, h)));
+}
+
+} //namespace math_detail
+
+// sin(x) and cos(x). x is reduced to r in [-pi/4, pi/4] and a quadrant q by
+// subtracting q * pi/2 in parts of 11 bits, which q multiplies exactly up to
+// |x| = 8192, and a last full one (four parts for Precise, two for Fast);
+// then minimax polynomials in r^2 of degree 3 and 4 (Precise) or 2 and 3
+// (Fast).
+template<typename Ops, Accuracy accuracy = Accuracy::Precise, typename V = typename Ops::type>
+void sincos(V x, V& s, V& c) {
+    namespace md = math_detail;
+    const bool precise = accuracy == Accuracy::Precise;
+    const V q = Ops::round(Ops::mul(x, Ops::set1(0.636619772f)));
+    V r = Ops::madd(q, Ops::set1(-1.5703125f), x);
+    if(precise) {
+        r = Ops::madd(q, Ops::set1(-4.837512969970703125e-4f), r);
+        r = Ops::madd(q, Ops::set1(-7.5495336204767227173e-8f), r);
+        r = Ops::madd(q, Ops::set1(-2.56334407e-12f), r);
+    } else {
+        r = Ops::madd(q, Ops::set1(-4.838267949e-4f), r);
+    }
+
+    const V z = Ops::mul(r, r);
+    const V sp = precise ? Ops::madd(Ops::mul(r, z), md::horner<Ops>(z, -1.666665461e-1f, 8.332160762e-3f, -1.951528319e-4f), r)
+                         : Ops::madd(Ops::mul(r, z), md::horner<Ops>(z, -1.666339038e-1f, 8.163281921e-3f), r);
+    const V cp = precise ? Ops::madd(Ops::mul(z, z), md::horner<Ops>(z, 4.166664568e-2f, -1.388731625e-3f, 2.443315705e-5f),
+                                     Ops::madd(z, Ops::set1(-0.5f), Ops::set1(1.0f)))
+                         : Ops::madd(Ops::mul(z, z), md::horner<Ops>(z, 4.166107131e-2f, -1.364871437e-3f),
+                                     Ops::madd(z, Ops::set1(-0.5f), Ops::set1(1.0f)));
+
+    // q mod 4 in 0..3 without integer ops: q/4 - 3/8 never rounds on a tie
+    const V q4 = Ops::madd(Ops::round(Ops::madd(q, Ops::set1(0.25f), Ops::set1(-0.375f))), Ops::set1(-4.0f), q);
+    const V odd = Ops::madd(Ops::round(Ops::madd(q4, Ops::set1(0.5f), Ops::set1(-0.25f))), Ops::set1(-2.0f), q4);
+    const auto swap = Ops::less(Ops::set1(0.5f), odd);
+    const auto negSin = Ops::less(Ops::set1(1.5f), q4);
+    const auto negCos = Ops::less(Ops::abs(Ops::sub(q4, Ops::set1(1.5f))), Ops::set1(1.0f)); // q4 is 1 or 2
+
+    s = Ops::select(swap, cp, sp);
+    c = Ops::select(swap, sp, cp);
+    s = Ops::select(negSin, md::negate<Ops>(s), s);
+    c = Ops::select(negCos, md::negate<Ops>(c), c);
+}
+
+template<typename Ops, Accuracy accuracy = Accuracy::Precise, typename V = typename Ops::type>
+V sin(V x) {
+    V s, c;
+    sincos<Ops, accuracy>(x, s, c);
+    return s;
+}
+
+template<typename Ops, Accuracy accuracy = Accuracy::Precise, typename V = typename Ops::type>
+V cos(V x) {
+    V s, c;
+    sincos<Ops, accuracy>(x, s, c);
+    return c;
+}
+
+// e^x = 2^n * e^r with n = round(x / ln 2) and |r| <= ln(2)/2; e^r is
+// 1 + r + r^2 * p(r) with p of degree 4 (Precise) or 3 (Fast)
+template<typename Ops, Accuracy accuracy = Accuracy::Precise, typename V = typename Ops::type>
+V exp(V x) {
+    namespace md = math_detail;
+    const V xc = Ops::min(Ops::max(x, Ops::set1(-104.0f)), Ops::set1(88.7228394f));
+    const V n = Ops::round(Ops::mul(xc, Ops::set1(1.44269504089f)));
+    V r = Ops::madd(n, Ops::set1(-0.693359375f), xc);
+    r = Ops::madd(n, Ops::set1(2.12194440e-4f), r);
+
+    const V p = accuracy == Accuracy::Precise
+              ? md::horner<Ops>(r, 5.000000058e-1f, 1.666650249e-1f, 4.166675329e-2f, 8.370428006e-3f, 1.390323453e-3f)
+              : md::horner<Ops>(r, 5.000035779e-1f, 1.667213245e-1f, 4.180177680e-2f, 7.899955431e-03f);
+    const V er = Ops::madd(Ops::mul(r, r), p, Ops::add(r, Ops::set1(1.0f)));
+    const V y = md::ldexp<Ops>(er, n);
+    return Ops::select(Ops::less(Ops::set1(88.7228394f), x), Ops::set1(HUGE_VALF), y);
+}
+
+// log(x) = e * ln 2 + log(1 + f) with x = 2^e * (1 + f), sqrt(1/2) <= 1 + f <
+// sqrt(2); log(1 + f) is f - f^2/2 + f^3 * p(f) with p of degree 6 (Precise)
+// or 4 (Fast)
+template<typename Ops, Accuracy accuracy = Accuracy::Precise, typename V = typename Ops::type>
+V log(V x) {
+    namespace md = math_detail;
+    // denormals are scaled into the normal range first
+    const auto tiny = Ops::less(x, Ops::set1(1.17549435e-38f));
+    const V xs = Ops::select(tiny, Ops::mul(x, Ops::set1(8388608.0f)), x);
+
+    V e;
+    V m = Ops::frexp(xs, e);
+    e = Ops::select(tiny, Ops::sub(e, Ops::set1(23.0f)), e);
+    const auto low = Ops::less(m, Ops::set1(0.707106781f));
+    m = Ops::select(low, Ops::add(m, m), m);
+    e = Ops::select(low, Ops::sub(e, Ops::set1(1.0f)), e);
+
+    const V f = Ops::sub(m, Ops::set1(1.0f)), z = Ops::mul(f, f);
+    const V p = accuracy == Accuracy::Precise
+              ? md::horner<Ops>(f, 3.333391074e-1f, -2.500133704e-1f, 1.996306384e-1f, -1.657758464e-1f,
+                                   1.491476742e-1f, -1.426748722e-1f, 8.700437705e-2f)
+              : md::horner<Ops>(f, 3.332086091e-1f, -2.494383273e-1f, 2.044218722e-1f, -1.840719000e-1f, 1.178190024e-1f);
+    // ln 2 in two parts, the first exact in e * ln2_hi
+    V y = Ops::madd(Ops::mul(z, f), p, Ops::mul(e, Ops::set1(-2.12194440e-4f)));
+    y = Ops::madd(z, Ops::set1(-0.5f), y);
+    y = Ops::madd(e, Ops::set1(0.693359375f), Ops::add(f, y));
+
+    y = Ops::select(Ops::less(Ops::set1(3.40282347e38f), x), Ops::set1(HUGE_VALF), y);
+    y = Ops::select(Ops::less(Ops::set1(0.0f), x), y, Ops::set1(-HUGE_VALF));
+    return Ops::select(Ops::less(x, Ops::set1(0.0f)), Ops::set1(NAN), y);
+}
+
+// atan(a) for a = min(|x|, |y|) / max(|x|, |y|) in [0, 1], then moved to the
+// octant of (x, y). Precise maps a > tan(pi/8) to (a - 1) / (a + 1) and uses
+// a polynomial of degree 3 in a^2; Fast one of degree 5 on all of [0, 1].
+template<typename Ops, Accuracy accuracy = Accuracy::Precise, typename V = typename Ops::type>
+V atan2(V y, V x) {
+    namespace md = math_detail;
+    const V ax = Ops::abs(x), ay = Ops::abs(y);
+    const V hi = Ops::max(ax, ay), lo = Ops::min(ax, ay);
+    V a = Ops::select(Ops::less(Ops::set1(0.0f), hi), Ops::div(lo, hi), Ops::set1(0.0f));
+
+    V r;
+    if(accuracy == Accuracy::Precise) {
+        const auto big = Ops::less(Ops::set1(0.414213562f), a);
+        a = Ops::select(big, Ops::div(Ops::sub(a, Ops::set1(1.0f)), Ops::add(a, Ops::set1(1.0f))), a);
+        const V z = Ops::mul(a, a);
+        r = Ops::madd(Ops::mul(a, z), md::horner<Ops>(z, -3.333294914e-1f, 1.997771003e-1f, -1.387767874e-1f, 8.053722698e-2f), a);
+        r = Ops::add(r, Ops::select(big, Ops::set1(0.785398163f), Ops::set1(0.0f)));
+    } else {
+        const V z = Ops::mul(a, a);
+        r = Ops::madd(Ops::mul(a, z), md::horner<Ops>(z, -3.332849195e-1f, 1.989787337e-1f, -1.354457642e-1f,
+                                                          8.484104417e-2f, -3.779672430e-2f, 8.106369078e-3f), a);
+    }
+
+    r = Ops::select(Ops::less(ax, ay), Ops::sub(Ops::set1(1.57079633f), r), r);
+    r = Ops::select(Ops::less(x, Ops::set1(0.0f)), Ops::sub(Ops::set1(3.14159265f), r), r);
+    return Ops::mulsign(r, y);
+}
+
+} //namespace simd
+
+namespace Math {
+
+namespace fast_math_detail {
+
+// out[i] = F::eval(in[i]) with Wide<float> for the bulk and Scalar<float> for
+// the tail
+template<typename F>
+void apply(const float* in, float* out, std::size_t count) {
+    using Wide = simd::Wide<float>;
+    using Scalar = simd::Scalar<float>;
+    const std::size_t bulk = count - count % Wide::width;
+    std::size_t i = 0;
+    for(; i < bulk; i += Wide::width) Wide::storeu(out + i, F::template eval<Wide>(Wide::loadu(in + i)));
+    for(; i < count; ++i) out[i] = F::template eval<Scalar>(in[i]);
+}
+
+#define FAST_MATH_FUNCTION(Name, function) \
+    template<simd::Accuracy accuracy> \
+    struct Name { \
+        template<typename Ops> \
+        static typename Ops::type eval(typename Ops::type x) { return simd::function<Ops, accuracy>(x); } \
+    };
+
+FAST_MATH_FUNCTION(Sin, sin)
+FAST_MATH_FUNCTION(Cos, cos)
+FAST_MATH_FUNCTION(Exp, exp)
+FAST_MATH_FUNCTION(Log, log)
+
+#undef FAST_MATH_FUNCTION
+
+} //namespace fast_math_detail
+
+// One float at a time. For new code these supersede fSin / fCos.
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+inline float fastSin(float x) { return simd::sin<simd::Scalar<float>, accuracy>(x); }
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+inline float fastCos(float x) { return simd::cos<simd::Scalar<float>, accuracy>(x); }
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+inline void fastSinCos(float x, float& s, float& c) { simd::sincos<simd::Scalar<float>, accuracy>(x, s, c); }
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+inline float fastExp(float x) { return simd::exp<simd::Scalar<float>, accuracy>(x); }
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+inline float fastLog(float x) { return simd::log<simd::Scalar<float>, accuracy>(x); }
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+inline float fastAtan2(float y, float x) { return simd::atan2<simd::Scalar<float>, accuracy>(y, x); }
+
+// Whole arrays, a vector at a time; out may be in
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+void fastSin(const float* in, float* out, std::size_t count) {
+    fast_math_detail::apply<fast_math_detail::Sin<accuracy>>(in, out, count);
+}
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+void fastCos(const float* in, float* out, std::size_t count) {
+    fast_math_detail::apply<fast_math_detail::Cos<accuracy>>(in, out, count);
+}
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+void fastExp(const float* in, float* out, std::size_t count) {
+    fast_math_detail::apply<fast_math_detail::Exp<accuracy>>(in, out, count);
+}
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+void fastLog(const float* in, float* out, std::size_t count) {
+    fast_math_detail::apply<fast_math_detail::Log<accuracy>>(in, out, count);
+}
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+void fastSinCos(const float* in, float* s, float* c, std::size_t count) {
+    using Ops = simd::Wide<float>;
+    const std::size_t bulk = count - count % Ops::width;
+    std::size_t i = 0;
+    for(; i < bulk; i += Ops::width) {
+        Ops::type vs, vc;
+        simd::sincos<Ops, accuracy>(Ops::loadu(in + i), vs, vc);
+        Ops::storeu(s + i, vs);
+        Ops::storeu(c + i, vc);
+    }
+    for(; i < count; ++i) fastSinCos<accuracy>(in[i], s[i], c[i]);
+}
+
+template<simd::Accuracy accuracy = simd::Accuracy::Precise>
+void fastAtan2(const float* y, const float* x, float* out, std::size_t count) {
+    using Ops = simd::Wide<float>;
+    const std::size_t bulk = count - count % Ops::width;
+    std::size_t i = 0;
+    for(; i < bulk; i += Ops::width)
+        Ops::storeu(out + i, simd::atan2<Ops, accuracy>(Ops::loadu(y + i), Ops::loadu(x + i)));
+    for(; i < count; ++i) out[i] = fastAtan2<accuracy>(y[i], x[i]);
+}
+
+} //namespace Math
+
+#endif // FAST_MATH_H
@@ -19,6 +19,8 @@ namespace Math {
 #define M_SQRT3         1.7320508075688772935274463415059f
 
 //(kinda optimized) math functions
+//fast_math.h has branch-free fastSin / fastCos / fastExp / ... with known error
+//bounds that also run over whole arrays in SIMD
 inline float fSinCosRecurse (float ret, float rad, const float rad2, float radpow, float fact, const int prec, int cur) {
     radpow *= -rad2;
     fact   *= cur++;
@@ -103,8 +105,10 @@ inline std::pair<std::complex<float>, std::complex<float> > solveQuadratic(float
     return std::make_pair(x1, x2);
 }
 
+// Whether segment p1-p2 crosses segment q1-q2. segments.h tests whole
+// arrays of segments against each other.
 inline bool doIntersect(Vector2f p1, Vector2f q1, Vector2f p2, Vector2f q2) {
-    static auto det = [](const Vector2f& u, const Vector2f& v) {return u.x*v.y - u.y*v.x;};
+    auto det = [](const Vector2f& u, const Vector2f& v) {return u.x*v.y - u.y*v.x;};
     return (det(p2-p1, q1-p1)*det(p2-p1, q2-p1) < 0) && (det(q2-q1, p1-q1)*det(q2-q1, p2-q1) < 0);
 }
 
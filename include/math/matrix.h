@@ -7,26 +7,61 @@
 #include <cmath>
 #include <ostream>
 #include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <cassert>
+
+#include "simd.h"
+
+// Define MATRIX_ALIGNED to align Vector<4,T> and Matrix<4,4,T> (and thus every
+// matrix column) to 4*sizeof(T) bytes, so the SIMD kernels use aligned loads.
+#ifdef MATRIX_ALIGNED
+#define MATRIX_ALIGN(T) alignas(4*sizeof(T))
+#else
+#define MATRIX_ALIGN(T)
+#endif
+
+// The SIMD overloads for Vector4f and Matrix4f are constexpr when the compiler
+// can tell constant evaluation apart (GCC 10+, Clang 9+): at compile time
+// they return the generic result instead.
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define MATRIX_SIMD_CONSTEXPR constexpr
+#define MATRIX_IF_CONSTANT_EVALUATED(...) if(__builtin_is_constant_evaluated()) return __VA_ARGS__
+#endif
+#endif
+#ifndef MATRIX_SIMD_CONSTEXPR
+#define MATRIX_SIMD_CONSTEXPR
+#define MATRIX_IF_CONSTANT_EVALUATED(...)
+#endif
+
+namespace matrix_detail {
+
+// Angles and lengths for element type T: T itself if floating-point, else float
+template<typename T>
+using real_t = typename std::conditional<std::is_floating_point<T>::value, T, float>::type;
+
+} //namespace matrix_detail
 
 template <int n, typename T = float>
 struct Vector {
     T data[n];
-    T& operator[](int i) { return data[i]; }
+    constexpr T& operator[](int i) { return data[i]; }
 
-    const T& operator[](int i) const { return data[i]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
 };
 
 template <int rows, int cols, typename T = float>
 struct Matrix {
     T data[rows*cols];
 
-    T &operator[](int i) { return data[i]; }
-    T& operator()(int row, int col) { return data[row + col*rows]; }
+    constexpr T& operator[](int i) { return data[i]; }
+    constexpr T& operator()(int row, int col) { return data[row + col*rows]; }
 
-    const T& operator()(int row, int col) const { return data[row + col*rows]; }
-    const T& operator[](int i) const { return data[i]; }
+    constexpr const T& operator()(int row, int col) const { return data[row + col*rows]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
 
-    float det() const;
+    constexpr T det() const;
 };
 
 //Most used vector types
@@ -55,6 +90,14 @@ using Matrix2u = Matrix<2,2, unsigned>;
 using Matrix3u = Matrix<3,3, unsigned>;
 using Matrix4u = Matrix<4,4, unsigned>;
 
+using Vector2d = Vector<2, double>;
+using Vector3d = Vector<3, double>;
+using Vector4d = Vector<4, double>;
+
+using Matrix2d = Matrix<2,2, double>;
+using Matrix3d = Matrix<3,3, double>;
+using Matrix4d = Matrix<4,4, double>;
+
 ///////////////// Vector Specializations /////////////////
 // Specializations for n = 2, 3, 4 so that we can access each
 // component of a vector through .a notation, as well as access
@@ -66,12 +109,12 @@ struct Vector<2, T> {
         T data[2];
         struct { T x, y; };
     };
-    T& operator[](int i) { return data[i]; }
-    const T& operator[](int i) const { return data[i]; }
+    constexpr T& operator[](int i) { return data[i]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
 
     Vector() = default;
-    explicit Vector(T num);
-    Vector(T x, T y);
+    constexpr explicit Vector(T num);
+    constexpr Vector(T x, T y);
 };
 
 template <typename T>
@@ -82,16 +125,16 @@ struct Vector<3, T> {
         struct { T r, g, b; };
         Vector<2, T> xy;
     };
-    T& operator[](int i) { return data[i]; }
-    const T& operator[](int i) const { return data[i]; }
+    constexpr T& operator[](int i) { return data[i]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
 
     Vector() = default;
-    explicit Vector(T num);
-    Vector(T x, T y, T z);
+    constexpr explicit Vector(T num);
+    constexpr Vector(T x, T y, T z);
 };
 
 template <typename T>
-struct Vector<4, T> {
+struct MATRIX_ALIGN(T) Vector<4, T> {
     union {
         T data[4];
         struct { T x, y, z, w; };
@@ -100,12 +143,12 @@ struct Vector<4, T> {
         Vector<3, T> rgb;
         Vector<2, T> xy;
     };
-    T& operator[](int i) { return data[i]; }
-    const T& operator[](int i) const { return data[i]; }
+    constexpr T& operator[](int i) { return data[i]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
 
     Vector() = default;
-    explicit Vector(T num);
-    Vector(T x, T y, T z, T w);
+    constexpr explicit Vector(T num);
+    constexpr Vector(T x, T y, T z, T w);
 };
 
 ///////////////// Matrix Specializations /////////////////
@@ -124,15 +167,15 @@ struct Matrix<2, 2, T> {
         struct { T a11, a21, a12, a22; };
         struct { Vector<2,T> a1, a2; };
     };
-    const T& operator[](int i) const { return data[i]; }
-    T& operator[](int i) { return data[i]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
+    constexpr T& operator[](int i) { return data[i]; }
 
-    float det() const;
-    Matrix inverse();
+    constexpr T det() const;
+    constexpr Matrix inverse() const;
 
     Matrix() = default;
-    Matrix(int i, float theta = 0); //rotate
-    Matrix(T a0, T a1, T a2, T a3);
+    constexpr Matrix(int i, matrix_detail::real_t<T> theta = 0); //rotate
+    constexpr Matrix(T a0, T a1, T a2, T a3);
 };
 
 template <typename T>
@@ -143,58 +186,67 @@ struct Matrix<3, 3, T> {
         struct { T a11, a21, a31, a12, a22, a32, a13, a23, a33; };
         struct { Vector<3,T> a1, a2, a3; };
     };
-    T& operator[](int i) { return data[i]; }
-    const T& operator[](int i) const { return data[i]; }
+    constexpr T& operator[](int i) { return data[i]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
 
-    float det() const;
+    constexpr T det() const;
 
     Matrix() = default;
-    Matrix(int i, float theta = 0);
-    Matrix(int i, float arg1, float arg2);
-    Matrix(int i, const Vector<3,T>& v, float arg1);
-    Matrix(T a0, T a1, T a2,
-           T a3, T a4, T a5,
-           T a6, T a7, T a8);
+    constexpr Matrix(int i, matrix_detail::real_t<T> theta = 0);
+    constexpr Matrix(int i, matrix_detail::real_t<T> arg1, matrix_detail::real_t<T> arg2);
+    constexpr Matrix(int i, const Vector<3,T>& v, matrix_detail::real_t<T> arg1);
+    constexpr Matrix(T a0, T a1, T a2,
+                     T a3, T a4, T a5,
+                     T a6, T a7, T a8);
 };
 
 template <typename T>
-struct Matrix<4, 4, T> {
+struct MATRIX_ALIGN(T) Matrix<4, 4, T> {
     union {
         T data[16];
         T mat[4][4];
         struct { T a11, a21, a31, a41, a12, a22, a32, a42, a13, a23, a33, a43, a14, a24, a34, a44; };
         struct { Vector<4,T> a1, a2, a3, a4; };
     };
-    const T& operator[](int i) const { return data[i]; }
-    T& operator[](int i) { return data[i]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
+    constexpr T& operator[](int i) { return data[i]; }
 
-    float det() const;
+    constexpr T det() const;
 
     Matrix() = default;
-    Matrix(int i, float theta = 0);
-    Matrix(int i, float arg1, float arg2);
-    Matrix(int i, const Vector<3,T>& p);
-    Matrix(T a0, T a1, T a2, T a3,
-           T a4, T a5, T a6, T a7,
-           T a8, T a9, T a10, T a11,
-           T a12, T a13, T a14, T a15);
+    constexpr Matrix(int i, matrix_detail::real_t<T> theta = 0);
+    constexpr Matrix(int i, matrix_detail::real_t<T> arg1, matrix_detail::real_t<T> arg2);
+    constexpr Matrix(int i, const Vector<3,T>& p);
+    constexpr Matrix(T a0, T a1, T a2, T a3,
+                     T a4, T a5, T a6, T a7,
+                     T a8, T a9, T a10, T a11,
+                     T a12, T a13, T a14, T a15);
 };
 
 //////////// Matrix and vector constructors ////////////
+// All constructors are constexpr. They initialize the 'data' member of the
+// union, so in constant expressions read components through data or [] (x,
+// a1, ... are other union members). Rotations by an angle call sin/cos and
+// are only evaluated at run time; the fixed ones (MATRIX_IDENTITY,
+// MATRIX2_ROTATE_90, ...) and translations also work at compile time.
 
 #define templ_t template<typename T>
 
-templ_t Vector<2,T>::Vector(T num) : x(num), y(num)  { }
-templ_t Vector<3,T>::Vector(T num) : x(num), y(num), z(num) { }
-templ_t Vector<4,T>::Vector(T num) : x(num), y(num), z(num), w(num) { }
+templ_t constexpr Vector<2,T>::Vector(T num) : data{num, num} { }
+templ_t constexpr Vector<3,T>::Vector(T num) : data{num, num, num} { }
+templ_t constexpr Vector<4,T>::Vector(T num) : data{num, num, num, num} { }
 
-templ_t Vector<2,T>::Vector(T x, T y) : x(x), y(y) { }
-templ_t Vector<3,T>::Vector(T x, T y, T z) : x(x), y(y), z(z) { }
-templ_t Vector<4,T>::Vector(T x, T y, T z, T w) : x(x), y(y), z(z), w(w) { }
+templ_t constexpr Vector<2,T>::Vector(T x, T y) : data{x, y} { }
+templ_t constexpr Vector<3,T>::Vector(T x, T y, T z) : data{x, y, z} { }
+templ_t constexpr Vector<4,T>::Vector(T x, T y, T z, T w) : data{x, y, z, w} { }
 
 //TODO: use enum instead?
 #define MATRIX_IDENTITY    0
 #define MATRIX_ROTATION    1
+// Note: MATRIX_TRANSLATION puts p in data[3], data[7] and data[11], the last
+// row. The affine helpers (m_invert_affine, transform_points, the quaternion
+// conversions) take the translation from column 3, data[12..14], and need
+// the last row to be (0, 0, 0, 1); transpose such a matrix before using them.
 #define MATRIX_TRANSLATION 2
 #define MATRIX_ROTATION_X  3
 #define MATRIX_ROTATION_Y  4
@@ -205,10 +257,10 @@ templ_t Vector<4,T>::Vector(T x, T y, T z, T w) : x(x), y(y), z(z), w(w) { }
 #define MATRIX2_ROTATE_180 7
 #define MATRIX2_ROTATE_270 8
 
-templ_t Matrix<2,2,T>::Matrix(int i, float theta) {
+templ_t constexpr Matrix<2,2,T>::Matrix(int i, matrix_detail::real_t<T> theta) : data{} {
     switch(i) {
     case MATRIX_ROTATION: {
-        float st = sin(theta), ct = cos(theta);
+        const matrix_detail::real_t<T> st = sin(theta), ct = cos(theta);
         data[0] = ct, data[1] = -st,
         data[2] = st, data[3] = ct;
     }
@@ -237,40 +289,39 @@ templ_t Matrix<2,2,T>::Matrix(int i, float theta) {
     }
 }
 
-templ_t Matrix<2,2,T>::Matrix(T a0, T a1, T a2, T a3) {
+templ_t constexpr Matrix<2,2,T>::Matrix(T a0, T a1, T a2, T a3) : data{} {
     data[0] = a0; data[1] = a1;
     data[2] = a2; data[3] = a3;
 }
 
-templ_t float Matrix<2,2,T>::det() const {
+templ_t constexpr T Matrix<2,2,T>::det() const {
     return data[0]*data[3] - data[1]*data[2];
 }
 
-templ_t Matrix<2,2,T> Matrix<2,2,T>::inverse() {
-    return (1 / this->det()) * Matrix<2,2,T>(data[3], -data[1],
-                                            -data[2],  data[0]);
+templ_t constexpr Matrix<2,2,T> Matrix<2,2,T>::inverse() const {
+    return (T(1) / (data[0]*data[3] - data[1]*data[2])) * Matrix<2,2,T>(data[3], -data[1],
+                                                                       -data[2],  data[0]);
 }
 
-templ_t Matrix<3,3,T>::Matrix(int i, float theta) {
+templ_t constexpr Matrix<3,3,T>::Matrix(int i, matrix_detail::real_t<T> theta) : data{} {
     switch(i){
-        float ct, st;
         case MATRIX_ROTATION:
         case MATRIX_ROTATION_X: {
-            st = sin(theta), ct = cos(theta);
+            const matrix_detail::real_t<T> st = sin(theta), ct = cos(theta);
             data[0] = 1; data[1] = 0;  data[2] = 0;
             data[3] = 0; data[4] = ct; data[5] = -st;
             data[6] = 0; data[7] = st; data[8] = ct;
         }
         break;
         case MATRIX_ROTATION_Y: {
-            st = sin(theta), ct = cos(theta);
+            const matrix_detail::real_t<T> st = sin(theta), ct = cos(theta);
             data[0] = ct;  data[1] = 0;  data[2] = st;
             data[3] = 0;   data[4] = 1;  data[5] = 0;
             data[6] = -st; data[7] = 0;  data[8] = ct;
         }
         break;
         case MATRIX_ROTATION_Z: {
-            st = sin(theta), ct = cos(theta);
+            const matrix_detail::real_t<T> st = sin(theta), ct = cos(theta);
             data[0] = ct; data[1] = -st;data[2] = 0;
             data[3] = st; data[4] = ct; data[5] = 0;
             data[6] = 0;  data[7] = 0;  data[8] = 1;
@@ -284,11 +335,11 @@ templ_t Matrix<3,3,T>::Matrix(int i, float theta) {
     }
 }
 
-templ_t Matrix<3,3,T>::Matrix(int i, float arg1, float arg2) {
+templ_t constexpr Matrix<3,3,T>::Matrix(int i, matrix_detail::real_t<T> arg1, matrix_detail::real_t<T> arg2) : data{} {
     switch(i) {
         case MATRIX_ROTATION: {
-            float st = sin(arg1), ct = cos(arg1),
-            sp = sin(arg2), cp = cos(arg2);
+            const matrix_detail::real_t<T> st = sin(arg1), ct = cos(arg1),
+                                           sp = sin(arg2), cp = cos(arg2);
             data[0] = ct;    data[1] = -st;   data[2] = 0;
             data[3] = st*cp; data[4] = ct*cp; data[5] = -sp;
             data[6] = st*sp; data[7] = ct*sp; data[8] = cp;
@@ -297,14 +348,14 @@ templ_t Matrix<3,3,T>::Matrix(int i, float arg1, float arg2) {
     }
 }
 
-templ_t Matrix<3,3,T>::Matrix(int i, const Vector<3,T>& v, float arg1) {
+templ_t constexpr Matrix<3,3,T>::Matrix(int i, const Vector<3,T>& v, matrix_detail::real_t<T> arg1) : data{} {
     switch(i) {
         case MATRIX_ROTATION: {
-            float len = sqrt(v.x*v.x + v.y*v.y + v.z*v.z);
+            const matrix_detail::real_t<T> len = sqrt(v.x*v.x + v.y*v.y + v.z*v.z);
             Matrix<3,3,T> what(0,    -v.z,  v.y,
                                v.z,     0, -v.x,
                               -v.y,   v.x,    0);
-            Matrix<3,3,T> u = Matrix<3,3,T>(MATRIX_IDENTITY) + what/(len)*sin(arg1) + what*what/pow(len, 2)*(1 - cos(arg1));
+            Matrix<3,3,T> u = Matrix<3,3,T>(MATRIX_IDENTITY) + what/(len)*sin(arg1) + what*what/(len*len)*(1 - cos(arg1));
 
             for(int i = 0 ; i< 9; ++i)
                 data[i] = u.data[i];
@@ -313,27 +364,27 @@ templ_t Matrix<3,3,T>::Matrix(int i, const Vector<3,T>& v, float arg1) {
     }
 }
 
-templ_t Matrix<3,3,T>::Matrix(T a0, T a1, T a2,
-                              T a3, T a4, T a5,
-                              T a6, T a7, T a8)
+templ_t constexpr Matrix<3,3,T>::Matrix(T a0, T a1, T a2,
+                                        T a3, T a4, T a5,
+                                        T a6, T a7, T a8)
+    : data{}
 {
     data[0] = a0; data[1] = a1; data[2] = a2;
     data[3] = a3; data[4] = a4; data[5] = a5;
     data[6] = a6; data[7] = a7; data[8] = a8;
 }
 
-templ_t float Matrix<3,3,T>::det() const {
+templ_t constexpr T Matrix<3,3,T>::det() const {
     return data[0]*(data[4]*data[8] - data[5]*data[7]) -
            data[1]*(data[3]*data[8] - data[5]*data[6]) +
            data[2]*(data[3]*data[7] - data[4]*data[6]);
 }
 
-templ_t Matrix<4,4,T>::Matrix(int i, float theta) {
+templ_t constexpr Matrix<4,4,T>::Matrix(int i, matrix_detail::real_t<T> theta) : data{} {
     switch(i){
-        float st, ct;
         case MATRIX_ROTATION:
         case MATRIX_ROTATION_X: {
-            st = sin(theta), ct = cos(theta);
+            const matrix_detail::real_t<T> st = sin(theta), ct = cos(theta);
             data[0] = 1; data[1] = 0; data[2] = 0; data[3] = 0;
             data[4] = 0; data[5] = ct; data[6] = -st; data[7] = 0;
             data[8] = 0; data[9] = st; data[10] = ct; data[11] = 0;
@@ -341,7 +392,7 @@ templ_t Matrix<4,4,T>::Matrix(int i, float theta) {
         }
         break;
         case MATRIX_ROTATION_Y: {
-            st = sin(theta), ct = cos(theta);
+            const matrix_detail::real_t<T> st = sin(theta), ct = cos(theta);
             data[0] = ct; data[1] = 0; data[2] = st; data[3] = 0;
             data[4] = 0; data[5] = 1; data[6] = 0; data[7] = 0;
             data[8] = -st; data[9] = 0; data[10] = ct; data[11] = 0;
@@ -349,7 +400,7 @@ templ_t Matrix<4,4,T>::Matrix(int i, float theta) {
         }
         break;
         case MATRIX_ROTATION_Z: {
-            st = sin(theta), ct = cos(theta);
+            const matrix_detail::real_t<T> st = sin(theta), ct = cos(theta);
             data[0] = ct; data[1] = -st; data[2] = 0; data[3] = 0;
             data[4] = st; data[5] = ct; data[6] = 0; data[7] = 0;
             data[8] = 0; data[9] = 0; data[10] = 1; data[11] = 0;
@@ -364,11 +415,11 @@ templ_t Matrix<4,4,T>::Matrix(int i, float theta) {
     }
 }
 
-templ_t Matrix<4,4,T>::Matrix(int i, float arg1, float arg2) {
+templ_t constexpr Matrix<4,4,T>::Matrix(int i, matrix_detail::real_t<T> arg1, matrix_detail::real_t<T> arg2) : data{} {
     switch(i){
         case MATRIX_ROTATION: {
-            float st = sin(arg1), ct = cos(arg1),
-            sp = sin(arg2), cp = cos(arg2);
+            const matrix_detail::real_t<T> st = sin(arg1), ct = cos(arg1),
+                                           sp = sin(arg2), cp = cos(arg2);
             data[0] = ct; 	 data[1] = -st;   data[2] = 0;   data[3] = 0;
             data[4] = st*cp; data[5] = ct*cp; data[6] = -sp; data[7] = 0;
             data[8] = st*sp; data[9] = ct*sp; data[10] = cp; data[11] = 0;
@@ -378,23 +429,24 @@ templ_t Matrix<4,4,T>::Matrix(int i, float arg1, float arg2) {
     }
 }
 
-templ_t Matrix<4,4,T>::Matrix(int i, const Vector<3,T>& p) {
+templ_t constexpr Matrix<4,4,T>::Matrix(int i, const Vector<3,T>& p) : data{} {
     switch(i){
         case MATRIX_TRANSLATION: {
             for(int i = 0; i< 16; ++i)
                 data[i] = i%5 ==0;
-            data[3] = p.x;
-            data[7] = p.y;
-            data[11] = p.z;
+            data[3] = p.data[0];
+            data[7] = p.data[1];
+            data[11] = p.data[2];
         }
         break;
     }
 }
 
-templ_t Matrix<4,4,T>::Matrix(T a0, T a1, T a2, T a3,
-                              T a4, T a5, T a6, T a7,
-                              T a8, T a9, T a10, T a11,
-                              T a12, T a13, T a14, T a15)
+templ_t constexpr Matrix<4,4,T>::Matrix(T a0, T a1, T a2, T a3,
+                                        T a4, T a5, T a6, T a7,
+                                        T a8, T a9, T a10, T a11,
+                                        T a12, T a13, T a14, T a15)
+    : data{}
 {
     data[0] = a0;   data[1] = a1;   data[2] = a2;   data[3] = a3;
     data[4] = a4;   data[5] = a5;   data[6] = a6;   data[7] = a7;
@@ -402,7 +454,7 @@ templ_t Matrix<4,4,T>::Matrix(T a0, T a1, T a2, T a3,
     data[12] = a12; data[13] = a13; data[14] = a14; data[15] = a15;
 }
 
-templ_t float Matrix<4,4,T>::det() const {
+templ_t constexpr T Matrix<4,4,T>::det() const {
     return data[0] * Matrix<3,3,T>(data[5],data[6],data[7],data[9],data[10],data[11],data[13],data[14],data[15]).det()
           -data[1] * Matrix<3,3,T>(data[4],data[6],data[7],data[8],data[10],data[11],data[12],data[14],data[15]).det()
           +data[2] * Matrix<3,3,T>(data[4],data[5],data[7],data[8],data[9], data[11],data[12],data[13],data[15]).det()
@@ -412,147 +464,284 @@ templ_t float Matrix<4,4,T>::det() const {
 
 ///////////////// Matrix functions /////////////////
 
-template<int r, int c, typename T>
-float Matrix<r,c,T>::det() const {
-    if(r != c) return 0; //matrix has no determinant
-
-    if(r == 2 && c == 2) return data[0]*data[3] - data[1]*data[2];
-
-    const auto minor = [&](int a, int b) {
-        Matrix<r-1,c-1,T> mat;
-        int offset_i = 0, offset_j = 0;
-        for(int i = 0; i < r - 1; ++i) {
-            if(i == b) offset_i++;
-            for(int j = 0; j < c - 1; ++j) {
-                if(j == a) offset_j++;
-                mat[j + i*(c-1)] = (*this)(j + offset_j, i + offset_i);
-            }
-            offset_j = 0;
-        }
-        return mat;
-    };
-
-    //TODO: MAKE LAMBDAS _minor and _det!!!!!!
-    float sum = 0;
-    int factor = 1;
-    for(int i = 0; i < c; i++) {
-        sum += factor * data[i] * minor(i, 0).det();
-        factor *= -1;
-    }
-    return sum;
-}
-
 template <int r, int c, typename T>
-T* m_element(Matrix<r, c, T>* m, int row, int column) {
+constexpr T* m_element(Matrix<r, c, T>* m, int row, int column) {
     return m->data + row + (column * r);
 }
 
 template <int r, int c, typename T>
-Vector<r, T> m_getcolumn(const Matrix<r, c, T>& m, int column) {
-    Vector<r, T> result;
+constexpr Vector<r, T> m_getcolumn(const Matrix<r, c, T>& m, int column) {
+    Vector<r, T> result{};
     for (int i = 0; i < r; ++i)
         result.data[i] = m.data[i + (column * r)];
     return result;
 }
 
-template <int ra, int ca, int cb, typename T>
-Matrix<ra, cb, T> operator*(Matrix<ra, ca> a, Matrix<ca, cb, T> b) {
-    Matrix<ra, cb, T> result = {};
-    float *entry = (float*)result.data;
-    for (int col = 0; col < cb; col++)
-    for (int row = 0; row < ra; row++) {
-        for (int i = 0; i < ca; ++i) {
-            float x = a.data[i * ra + row];
-            float y = b.data[i + col * ca];
-            *entry += x * y;
-        }
-        entry++;
-    }
+template <int r, int c, typename T>
+constexpr Matrix<c, r, T> m_transpose(const Matrix<r, c, T>& m) {
+    Matrix<c, r, T> result = {};
+    for (int row = 0; row < r; row++)
+        for (int col = 0; col < c; col++)
+            result.data[col + row*c] = m.data[row + col*r];
     return result;
 }
 
-template <int r, int c>
-Matrix<r, c> operator+(const Matrix<r, c>& a, const Matrix<r, c>& b) {
-    Matrix<r, c> result;
-    for (int i = 0; i < r*c; ++i) result.data[i] = a.data[i] + b.data[i];
-    return result;
-}
+///////////////// Expression templates /////////////////
+// The arithmetic operators on Vector and Matrix do not compute anything:
+// they return a small expression object that records the operation. The
+// expression is evaluated when it is converted to a Vector or Matrix
+// (initialization, assignment, return, argument passing), element by
+// element in a single loop and without temporaries, e.g.
+//
+//     Matrix3f u = Matrix3f(MATRIX_IDENTITY) + w/len*s + w*w/(len*len)*(1 - c);
+//
+// computes each of the 9 elements once. A matrix product first evaluates
+// operands that are themselves expressions, so each product is computed once.
+//
+// Expressions refer to their Vector and Matrix operands, so store the result
+// in a Vector/Matrix (or call eval()) instead of in an 'auto' variable when an
+// operand is a temporary. Members such as .x or det() need eval() as well.
+namespace matrix_expr {
 
-template <int r, int c>
-Matrix<r, c> operator-(const Matrix<r, c>& a, const Matrix<r, c>& b) {
-    Matrix<r, c> result;
-    for (int i = 0; i < r*c; ++i) result.data[i] = a.data[i] - b.data[i];
-    return result;
-}
+template<typename E>
+struct traits { static constexpr bool is_expr = false; };
 
-template <int r, int c>
-Matrix<r, c> operator*(const Matrix<r, c>& a, float s) {
-    Matrix<r, c> result;
-    for (int i = 0; i < r*c; ++i) result.data[i] = a.data[i] * s;
-    return result;
-}
-template <int r, int c>
-Matrix<r, c> operator*(float s, const Matrix<r, c>& a) {
-    return a*s;
-}
+template<int n, typename T>
+struct traits<Vector<n, T>> {
+    using value_type = T;
+    static constexpr bool is_expr = true, is_leaf = true, is_matrix = false;
+    static constexpr int rows = n, cols = 1;
+};
 
-template <int r, int c>
-Matrix<r, c> operator-(const Matrix<r, c>& a) {
-    Matrix<r, c> result;
-    for (int i = 0; i < r*c; ++i) result.data[i] = -a.data[i];
-    return result;
-}
+template<int r, int c, typename T>
+struct traits<Matrix<r, c, T>> {
+    using value_type = T;
+    static constexpr bool is_expr = true, is_leaf = true, is_matrix = true;
+    static constexpr int rows = r, cols = c;
+};
 
+template<typename Op, typename L, typename R> struct Binary;
+template<typename Op, typename L, typename S> struct ScalarRight;
+template<typename Op, typename S, typename R> struct ScalarLeft;
+template<typename E> struct Negate;
+template<typename L, typename R> struct Product;
+
+// Elementwise nodes have the shape and element type of their operand(s)
+template<typename Op, typename L, typename R>
+struct traits<Binary<Op, L, R>> : traits<L> { static constexpr bool is_leaf = false; };
+template<typename Op, typename L, typename S>
+struct traits<ScalarRight<Op, L, S>> : traits<L> { static constexpr bool is_leaf = false; };
+template<typename Op, typename S, typename R>
+struct traits<ScalarLeft<Op, S, R>> : traits<R> { static constexpr bool is_leaf = false; };
+template<typename E>
+struct traits<Negate<E>> : traits<E> { static constexpr bool is_leaf = false; };
+
+template<typename L, typename R>
+struct traits<Product<L, R>> {
+    using value_type = typename traits<L>::value_type;
+    static constexpr bool is_expr = true, is_leaf = false, is_matrix = traits<R>::is_matrix;
+    static constexpr int rows = traits<L>::rows, cols = traits<R>::cols;
+};
 
-template <int r, int c, typename T>
-Matrix<c, r, T> m_transpose(Matrix<r, c, T> m) {
-    Matrix<c, r, T> result = {};
-    for (int row = 0; row < r; row++)
-        for (int col = 0; col < c; col++) {
-            T* a = m_element(&result, col, row);
-            T* b = m_element(&m, row, col);
-            *a = *b;
-        }
-    return result;
-}
+// The Vector or Matrix an expression evaluates to
+template<typename E>
+using concrete_t = typename std::conditional<traits<E>::is_matrix,
+    Matrix<traits<E>::rows, traits<E>::cols, typename traits<E>::value_type>,
+    Vector<traits<E>::rows, typename traits<E>::value_type>>::type;
+
+// Leaves are held by reference, nested expressions by value
+template<typename E>
+using operand_t = typename std::conditional<traits<E>::is_leaf, const E&, const E>::type;
+
+template<typename E, bool = traits<E>::is_expr>
+struct is_node : std::false_type {};
+template<typename E>
+struct is_node<E, true> : std::integral_constant<bool, !traits<E>::is_leaf> {};
+
+// Operands must have the same element type, as with the plain Vector and
+// Matrix operators: Vector3i + Vector3f has no type that would not drop
+// part of one side
+template<typename L, typename R, bool = traits<L>::is_expr && traits<R>::is_expr>
+struct same_shape : std::false_type {};
+template<typename L, typename R>
+struct same_shape<L, R, true> : std::integral_constant<bool,
+    std::is_same<typename traits<L>::value_type, typename traits<R>::value_type>::value &&
+    traits<L>::is_matrix == traits<R>::is_matrix &&
+    traits<L>::rows == traits<R>::rows && traits<L>::cols == traits<R>::cols> {};
+
+template<typename L, typename R, bool = same_shape<L, R>::value>
+struct same_vector : std::false_type {};
+template<typename L, typename R>
+struct same_vector<L, R, true> : std::integral_constant<bool, !traits<L>::is_matrix> {};
+
+template<typename L, typename R, bool = traits<L>::is_expr && traits<R>::is_expr>
+struct can_multiply : std::false_type {};
+template<typename L, typename R>
+struct can_multiply<L, R, true> : std::integral_constant<bool,
+    std::is_same<typename traits<L>::value_type, typename traits<R>::value_type>::value &&
+    traits<L>::is_matrix && traits<L>::cols == traits<R>::rows> {};
+
+// Any arithmetic scalar, as the operators taking a float did; the result is
+// converted back to the element type
+template<typename E, typename S>
+struct with_scalar : std::integral_constant<bool, traits<E>::is_expr && std::is_arithmetic<S>::value> {};
+
+template<typename Derived>
+struct Node {
+    constexpr concrete_t<Derived> eval() const {
+        const Derived& self = static_cast<const Derived&>(*this);
+        concrete_t<Derived> result{};
+        for(int i = 0; i < traits<Derived>::rows * traits<Derived>::cols; ++i) result.data[i] = self[i];
+        return result;
+    }
+    constexpr operator concrete_t<Derived>() const { return eval(); }
+};
+
+template<typename Op, typename L, typename R>
+struct Binary : Node<Binary<Op, L, R>> {
+    using value_type = typename traits<L>::value_type;
+    operand_t<L> l;
+    operand_t<R> r;
+    constexpr Binary(const L& l, const R& r) : l(l), r(r) { }
+    constexpr value_type operator[](int i) const { return Op()(l[i], r[i]); }
+};
+
+// The scalar keeps its own type, so Vector3f * 0.1 multiplies by the double
+// and Vector3i(3) * 2.5f gives 7 as before
+template<typename Op, typename L, typename S>
+struct ScalarRight : Node<ScalarRight<Op, L, S>> {
+    using value_type = typename traits<L>::value_type;
+    operand_t<L> l;
+    S s;
+    constexpr ScalarRight(const L& l, S s) : l(l), s(s) { }
+    constexpr value_type operator[](int i) const { return Op()(l[i], s); }
+};
+
+template<typename Op, typename S, typename R>
+struct ScalarLeft : Node<ScalarLeft<Op, S, R>> {
+    using value_type = typename traits<R>::value_type;
+    S s;
+    operand_t<R> r;
+    constexpr ScalarLeft(S s, const R& r) : s(s), r(r) { }
+    constexpr value_type operator[](int i) const { return Op()(s, r[i]); }
+};
+
+template<typename E>
+struct Negate : Node<Negate<E>> {
+    using value_type = typename traits<E>::value_type;
+    operand_t<E> e;
+    constexpr explicit Negate(const E& e) : e(e) { }
+    constexpr value_type operator[](int i) const { return -e[i]; }
+};
+
+// Matrix * matrix or matrix * vector. Element i (column-major) is the dot
+// product of a row of l and a column of r.
+template<typename L, typename R>
+struct Product : Node<Product<L, R>> {
+    using value_type = typename traits<L>::value_type;
+    static constexpr int rows = traits<L>::rows, inner = traits<L>::cols;
+    typename std::conditional<traits<L>::is_leaf, const L&, const concrete_t<L>>::type l;
+    typename std::conditional<traits<R>::is_leaf, const R&, const concrete_t<R>>::type r;
+    constexpr Product(const L& l, const R& r) : l(l), r(r) { }
+    constexpr value_type operator[](int i) const {
+        const int row = i % rows, col = i / rows;
+        value_type sum = 0;
+        for(int k = 0; k < inner; ++k) sum += l[row + k*rows] * r[k + col*inner];
+        return sum;
+    }
+};
+
+} //namespace matrix_expr
+
+// -A, A+B, A-B (same shape), A*B and A/B (component-wise, vectors only),
+// A*s, s*A, A/s, and M*B (matrix product, B a matrix or vector)
+template<typename L, typename R>
+constexpr auto operator+(const L& l, const R& r) -> typename std::enable_if<matrix_expr::same_shape<L, R>::value,
+    matrix_expr::Binary<std::plus<>, L, R>>::type { return {l, r}; }
+
+template<typename L, typename R>
+constexpr auto operator-(const L& l, const R& r) -> typename std::enable_if<matrix_expr::same_shape<L, R>::value,
+    matrix_expr::Binary<std::minus<>, L, R>>::type { return {l, r}; }
+
+template<typename E>
+constexpr auto operator-(const E& e) -> typename std::enable_if<matrix_expr::traits<E>::is_expr,
+    matrix_expr::Negate<E>>::type { return matrix_expr::Negate<E>(e); }
+
+template<typename L, typename R>
+constexpr auto operator*(const L& l, const R& r) -> typename std::enable_if<matrix_expr::same_vector<L, R>::value,
+    matrix_expr::Binary<std::multiplies<>, L, R>>::type { return {l, r}; }
+
+template<typename L, typename R>
+constexpr auto operator*(const L& l, const R& r) -> typename std::enable_if<matrix_expr::can_multiply<L, R>::value,
+    matrix_expr::Product<L, R>>::type { return {l, r}; }
+
+template<typename L, typename R>
+constexpr auto operator/(const L& l, const R& r) -> typename std::enable_if<matrix_expr::same_vector<L, R>::value,
+    matrix_expr::Binary<std::divides<>, L, R>>::type { return {l, r}; }
 
-//TODO: m_invert() ?
+template<typename E, typename S>
+constexpr auto operator*(const E& e, S s) -> typename std::enable_if<matrix_expr::with_scalar<E, S>::value,
+    matrix_expr::ScalarRight<std::multiplies<>, E, S>>::type { return {e, s}; }
+
+template<typename S, typename E>
+constexpr auto operator*(S s, const E& e) -> typename std::enable_if<matrix_expr::with_scalar<E, S>::value,
+    matrix_expr::ScalarLeft<std::multiplies<>, S, E>>::type { return {s, e}; }
+
+template<typename E, typename S>
+constexpr auto operator/(const E& e, S s) -> typename std::enable_if<matrix_expr::with_scalar<E, S>::value,
+    matrix_expr::ScalarRight<std::divides<>, E, S>>::type { return {e, s}; }
+
+template<typename E>
+constexpr auto m_transpose(const E& e) -> typename std::enable_if<matrix_expr::is_node<E>::value && matrix_expr::traits<E>::is_matrix,
+    Matrix<matrix_expr::traits<E>::cols, matrix_expr::traits<E>::rows, typename matrix_expr::traits<E>::value_type>>::type {
+    return m_transpose(e.eval());
+}
 
 ///////////////// Vector functions /////////////////
 // 	   a := vector of dimension N and type T
 //     b := another vector of dimension N and type T
-//     s := scalar of same type T
+//     s := scalar
 //
-// The following operators are defined
+// Besides the operators above, the following are defined
 //
-//     -A        :: Component-wise negation of A
-//     A+B = B+A :: B added component-wise to A
-//     A-B       :: B subtracted component-wise from A
-//     A*s = s*A :: s multiplied each component of A
-//     A*B = B*A :: A multiplied component-wise by B
-//     A/B       :: A divided component-wise by B
+//     A += B, A -= B, A *= B, A /= B :: component-wise, B may be an expression
+//     A *= s, A /= s
 //     m_dot(A, B) :: The inner product of A and B
+//
+// The functions below also accept vector expressions.
 #define vector_template template <int n, typename T>
 #define vec_t Vector<n, T>
 
-vector_template vec_t  operator+(vec_t a, vec_t b)   { vec_t r; for (int i=0; i<n; ++i) r.data[i] = a.data[i]+b.data[i]; return r; }
-vector_template vec_t  operator-(vec_t a, vec_t b)   { vec_t r; for (int i=0; i<n; ++i) r.data[i] = a.data[i]-b.data[i]; return r; }
-vector_template vec_t  operator-(vec_t a)            { vec_t r; for (int i=0; i<n; ++i) r.data[i] = -a.data[i];          return r; }
-vector_template vec_t  operator*(vec_t v, float s)   { vec_t r; for (int i=0; i<n; ++i) r.data[i] = v.data[i]*s;         return r; }
-vector_template vec_t  operator*(float s, vec_t v)   { vec_t r; for (int i=0; i<n; ++i) r.data[i] = v.data[i]*s;         return r; }
-vector_template vec_t  operator*(vec_t a, vec_t b)   { vec_t r; for (int i=0; i<n; ++i) r.data[i] = a.data[i]*b.data[i]; return r; }
-vector_template vec_t  operator/(vec_t a, vec_t b)   { vec_t r; for (int i=0; i<n; ++i) r.data[i] = a.data[i]/b.data[i]; return r; }
-vector_template vec_t  operator/(vec_t v, float s)   { vec_t r; for (int i=0; i<n; ++i) r.data[i] = v.data[i]/s;         return r; }
-
-vector_template vec_t& operator+=(vec_t& a, vec_t b)  { for (int i = 0; i < n; ++i) a.data[i] += b.data[i]; return a; }
-vector_template vec_t& operator-=(vec_t& a, vec_t b)  { for (int i = 0; i < n; ++i) a.data[i] -= b.data[i]; return a; }
-vector_template vec_t& operator*=(vec_t& v, float s)  { for (int i = 0; i < n; ++i) v.data[i] *= s;         return v; }
-vector_template vec_t& operator*=(vec_t& a, vec_t b)  { for (int i = 0; i < n; ++i) a.data[i] *= b.data[i]; return a; }
-vector_template vec_t& operator/=(vec_t& a, vec_t b)  { for (int i = 0; i < n; ++i) a.data[i] /= b.data[i]; return a; }
-vector_template vec_t& operator/=(vec_t& v, float s)  { for (int i = 0; i < n; ++i) v.data[i] /= s;         return v; }
+// The right-hand side is evaluated first, so v += m*v reads the old v
+template <int n, typename T, typename E>
+constexpr auto operator+=(vec_t& a, const E& b) -> typename std::enable_if<matrix_expr::same_vector<vec_t, E>::value, vec_t&>::type {
+    const vec_t v = b; for (int i = 0; i < n; ++i) a.data[i] += v.data[i]; return a;
+}
+template <int n, typename T, typename E>
+constexpr auto operator-=(vec_t& a, const E& b) -> typename std::enable_if<matrix_expr::same_vector<vec_t, E>::value, vec_t&>::type {
+    const vec_t v = b; for (int i = 0; i < n; ++i) a.data[i] -= v.data[i]; return a;
+}
+template <int n, typename T, typename E>
+constexpr auto operator*=(vec_t& a, const E& b) -> typename std::enable_if<matrix_expr::same_vector<vec_t, E>::value, vec_t&>::type {
+    const vec_t v = b; for (int i = 0; i < n; ++i) a.data[i] *= v.data[i]; return a;
+}
+template <int n, typename T, typename E>
+constexpr auto operator/=(vec_t& a, const E& b) -> typename std::enable_if<matrix_expr::same_vector<vec_t, E>::value, vec_t&>::type {
+    const vec_t v = b; for (int i = 0; i < n; ++i) a.data[i] /= v.data[i]; return a;
+}
+template <int n, typename T, typename S>
+constexpr auto operator*=(vec_t& v, S s) -> typename std::enable_if<std::is_arithmetic<S>::value, vec_t&>::type {
+    for (int i = 0; i < n; ++i) v.data[i] *= s;
+    return v;
+}
+template <int n, typename T, typename S>
+constexpr auto operator/=(vec_t& v, S s) -> typename std::enable_if<std::is_arithmetic<S>::value, vec_t&>::type {
+    for (int i = 0; i < n; ++i) v.data[i] /= s;
+    return v;
+}
 
 vector_template
-inline T m_dot(vec_t a, vec_t b) {
+constexpr inline T m_dot(vec_t a, vec_t b) {
     T result = 0;
     for (int i = 0; i < n; ++i)
         result += a.data[i] * b.data[i];
@@ -562,46 +751,538 @@ inline T m_dot(vec_t a, vec_t b) {
 #undef vec_t
 
 template<typename T>
-inline Vector<3,T> m_cross(const Vector<3,T>& a, const Vector<3,T>& b) {
-    return Vector<3,T>{a.y*b.z-a.z*b.y, a.z*b.x-a.x*b.z, a.x*b.y-a.y*b.x};
+constexpr inline Vector<3,T> m_cross(const Vector<3,T>& a, const Vector<3,T>& b) {
+    return Vector<3,T>{a[1]*b[2]-a[2]*b[1], a[2]*b[0]-a[0]*b[2], a[0]*b[1]-a[1]*b[0]};
+}
+
+// Cross product of the xyz parts of homogeneous vectors; w of the result is 0
+template<typename T>
+constexpr inline Vector<4,T> m_cross(const Vector<4,T>& a, const Vector<4,T>& b) {
+    return Vector<4,T>{a[1]*b[2]-a[2]*b[1], a[2]*b[0]-a[0]*b[2], a[0]*b[1]-a[1]*b[0], 0};
 }
 
 // Two-dimensional "cross-product" is the Z component of the cross-product between two 3D vectors where Z=0.
 // Alternatively it can be thought as the dotproduct of a vector and another vector but rotated 90 degrees.
 template<typename T>
-inline T m_cross(const Vector<2,T>& a, const Vector<2,T>& b) {
-    return a.x*b.y-a.y*b.x;
+constexpr inline T m_cross(const Vector<2,T>& a, const Vector<2,T>& b) {
+    return a[0]*b[1]-a[1]*b[0];
 }
 
-///////////// Vector matrix functions /////////////
-template <int r, int c, typename T>
-Vector<r, T> operator*(const Matrix<r, c, T>& m, const Vector<c, T>& x) {
-    Vector<r, T> result = {};
-    for (int col = 0; col < c; col++)
-        for (int row = 0; row < r; row++)
-            result.data[row] += m.data[row + col * r] * x.data[col];
+template <int n, typename T>
+inline matrix_detail::real_t<T> m_length(const Vector<n, T>& v) {
+    matrix_detail::real_t<T> result = std::sqrt(matrix_detail::real_t<T>(m_dot(v, v)));
+    return result;
+}
+
+template <int n, typename T>
+inline Vector<n, T> m_normalize(const Vector<n,T>& v) {
+    Vector<n, T> result = v / m_length(v);
+    return result;
+}
+
+// Overloads for vector expressions (at least one operand not a plain Vector)
+template<typename A, typename B>
+using enable_vector_expr_t = typename std::enable_if<matrix_expr::same_vector<A, B>::value &&
+    (matrix_expr::is_node<A>::value || matrix_expr::is_node<B>::value)>::type;
+
+template<typename A, typename B, typename = enable_vector_expr_t<A, B>>
+constexpr inline typename matrix_expr::traits<A>::value_type m_dot(const A& a, const B& b) {
+    typename matrix_expr::traits<A>::value_type result = 0;
+    for (int i = 0; i < matrix_expr::traits<A>::rows; ++i)
+        result += a[i] * b[i];
+    return result;
+}
+
+template<typename A, typename B, typename = enable_vector_expr_t<A, B>>
+constexpr inline auto m_cross(const A& a, const B& b) {
+    return m_cross(matrix_expr::concrete_t<A>(a), matrix_expr::concrete_t<B>(b));
+}
+
+template<typename E, typename = enable_vector_expr_t<E, E>>
+inline matrix_detail::real_t<typename matrix_expr::traits<E>::value_type> m_length(const E& e) { return m_length(e.eval()); }
+
+template<typename E, typename = enable_vector_expr_t<E, E>>
+inline matrix_expr::concrete_t<E> m_normalize(const E& e) { return m_normalize(e.eval()); }
+
+///////////////// Decompositions and inverses /////////////////
+// O(n^3) LU and Cholesky factorizations for square matrices of any size, and
+// det(), m_invert() and m_solve() built on them. 2x2, 3x3 and 4x4 inverses
+// and the determinants of those sizes use closed forms instead.
+namespace matrix_detail {
+
+template<typename T>
+constexpr T abs(T x) { return x < T(0) ? -x : x; }
+
+} //namespace matrix_detail
+
+// LU decomposition with partial pivoting, P*A = L*U. lu holds L below the
+// diagonal (its unit diagonal is implied) and U on and above it; row i of
+// P*A is row perm[i] of A.
+template<int n, typename T>
+struct MatrixLU {
+    Matrix<n, n, T> lu;
+    int perm[n];
+    int sign;      // determinant of P, 1 or -1
+    bool singular; // a pivot was 0: det() is 0, solve() and inverse() are undefined
+
+    constexpr T det() const {
+        T result = T(sign);
+        for(int i = 0; i < n; ++i) result *= lu.data[i + i*n];
+        return result;
+    }
+
+    // x with A*x = b
+    constexpr Vector<n, T> solve(const Vector<n, T>& b) const {
+        Vector<n, T> x{};
+        for(int i = 0; i < n; ++i) {
+            T sum = b.data[perm[i]];
+            for(int k = 0; k < i; ++k) sum -= lu.data[i + k*n] * x.data[k];
+            x.data[i] = sum;
+        }
+        for(int i = n - 1; i >= 0; --i) {
+            T sum = x.data[i];
+            for(int k = i + 1; k < n; ++k) sum -= lu.data[i + k*n] * x.data[k];
+            x.data[i] = sum / lu.data[i + i*n];
+        }
+        return x;
+    }
+
+    // X with A*X = B, one column at a time
+    template<int m>
+    constexpr Matrix<n, m, T> solve(const Matrix<n, m, T>& b) const {
+        Matrix<n, m, T> x{};
+        for(int j = 0; j < m; ++j) {
+            Vector<n, T> col{};
+            for(int i = 0; i < n; ++i) col.data[i] = b.data[i + j*n];
+            col = solve(col);
+            for(int i = 0; i < n; ++i) x.data[i + j*n] = col.data[i];
+        }
+        return x;
+    }
+
+    constexpr Matrix<n, n, T> inverse() const {
+        Matrix<n, n, T> identity{};
+        for(int i = 0; i < n; ++i) identity.data[i + i*n] = T(1);
+        return solve(identity);
+    }
+};
+
+template<int n, typename T>
+constexpr MatrixLU<n, T> m_lu(const Matrix<n, n, T>& a) {
+    MatrixLU<n, T> f{};
+    f.lu = a;
+    f.sign = 1;
+    f.singular = false;
+    for(int i = 0; i < n; ++i) f.perm[i] = i;
+
+    T* m = f.lu.data;
+    for(int k = 0; k < n; ++k) {
+        int p = k;
+        for(int i = k + 1; i < n; ++i)
+            if(matrix_detail::abs(m[i + k*n]) > matrix_detail::abs(m[p + k*n])) p = i;
+        if(p != k) {
+            for(int j = 0; j < n; ++j) {
+                const T t = m[k + j*n];
+                m[k + j*n] = m[p + j*n];
+                m[p + j*n] = t;
+            }
+            const int t = f.perm[k];
+            f.perm[k] = f.perm[p];
+            f.perm[p] = t;
+            f.sign = -f.sign;
+        }
+
+        const T pivot = m[k + k*n];
+        if(pivot == T(0)) {
+            f.singular = true;
+            continue;
+        }
+        for(int i = k + 1; i < n; ++i) m[i + k*n] /= pivot;
+        // rank-1 update of the trailing block, column by column
+        for(int j = k + 1; j < n; ++j) {
+            const T u = m[k + j*n];
+            for(int i = k + 1; i < n; ++i) m[i + j*n] -= m[i + k*n] * u;
+        }
+    }
+    return f;
+}
+
+// Cholesky decomposition A = L*L^T of a symmetric positive definite matrix
+// (covariance matrices, normal equations); half the work of LU and no
+// pivoting. Only the lower triangle of A is read.
+template<int n, typename T>
+struct MatrixCholesky {
+    Matrix<n, n, T> l; // lower triangular, zero above the diagonal
+    bool ok;           // false if A is not positive definite; l is then incomplete
+
+    T det() const {
+        T result = T(1);
+        for(int i = 0; i < n; ++i) result *= l.data[i + i*n];
+        return result * result;
+    }
+
+    // x with A*x = b: L*y = b, then L^T*x = y
+    Vector<n, T> solve(const Vector<n, T>& b) const {
+        Vector<n, T> x = b;
+        for(int i = 0; i < n; ++i) {
+            T sum = x.data[i];
+            for(int k = 0; k < i; ++k) sum -= l.data[i + k*n] * x.data[k];
+            x.data[i] = sum / l.data[i + i*n];
+        }
+        for(int i = n - 1; i >= 0; --i) {
+            T sum = x.data[i];
+            for(int k = i + 1; k < n; ++k) sum -= l.data[k + i*n] * x.data[k];
+            x.data[i] = sum / l.data[i + i*n];
+        }
+        return x;
+    }
+
+    template<int m>
+    Matrix<n, m, T> solve(const Matrix<n, m, T>& b) const {
+        Matrix<n, m, T> x{};
+        for(int j = 0; j < m; ++j) {
+            Vector<n, T> col{};
+            for(int i = 0; i < n; ++i) col.data[i] = b.data[i + j*n];
+            col = solve(col);
+            for(int i = 0; i < n; ++i) x.data[i + j*n] = col.data[i];
+        }
+        return x;
+    }
+
+    Matrix<n, n, T> inverse() const {
+        Matrix<n, n, T> identity{};
+        for(int i = 0; i < n; ++i) identity.data[i + i*n] = T(1);
+        return solve(identity);
+    }
+};
+
+template<int n, typename T>
+MatrixCholesky<n, T> m_cholesky(const Matrix<n, n, T>& a) {
+    MatrixCholesky<n, T> f{};
+    f.ok = true;
+    T* l = f.l.data;
+    for(int j = 0; j < n; ++j) {
+        T* col = l + j*n;
+        for(int i = j; i < n; ++i) col[i] = a.data[i + j*n];
+        for(int k = 0; k < j; ++k) {
+            const T ljk = l[j + k*n];
+            for(int i = j; i < n; ++i) col[i] -= l[i + k*n] * ljk;
+        }
+        if(!(col[j] > T(0))) {
+            f.ok = false;
+            return f;
+        }
+        const T d = std::sqrt(col[j]);
+        col[j] = d;
+        for(int i = j + 1; i < n; ++i) col[i] /= d;
+    }
+    return f;
+}
+
+namespace matrix_detail {
+
+template<int r, int c, typename T>
+constexpr T det(const Matrix<r, c, T>&) { return 0; } //matrix has no determinant
+
+// Integer matrices are factored in double and the result rounded
+template<int n, typename T>
+constexpr auto det(const Matrix<n, n, T>& m) -> typename std::enable_if<std::is_floating_point<T>::value, T>::type {
+    return m_lu(m).det();
+}
+
+template<int n, typename T>
+constexpr auto det(const Matrix<n, n, T>& m) -> typename std::enable_if<!std::is_floating_point<T>::value, T>::type {
+    Matrix<n, n, double> d{};
+    for(int i = 0; i < n*n; ++i) d.data[i] = double(m.data[i]);
+    const double result = m_lu(d).det();
+    return T(result < 0 ? result - 0.5 : result + 0.5);
+}
+
+} //namespace matrix_detail
+
+template<int r, int c, typename T>
+constexpr T Matrix<r,c,T>::det() const {
+    return matrix_detail::det(*this);
+}
+
+// x with a*x = b, for one right-hand side or a matrix of them. For symmetric
+// positive definite a, m_cholesky(a).solve(b) is faster.
+template<int n, typename T>
+constexpr Vector<n, T> m_solve(const Matrix<n, n, T>& a, const Vector<n, T>& b) {
+    return m_lu(a).solve(b);
+}
+
+template<int n, int m, typename T>
+constexpr Matrix<n, m, T> m_solve(const Matrix<n, n, T>& a, const Matrix<n, m, T>& b) {
+    return m_lu(a).solve(b);
+}
+
+// Inverse of a square matrix. It must be invertible: check m_lu(m).singular
+// or det() first when that is not known.
+template<int n, typename T>
+constexpr Matrix<n, n, T> m_invert(const Matrix<n, n, T>& m) {
+    return m_lu(m).inverse();
+}
+
+template<typename T>
+constexpr Matrix<2, 2, T> m_invert(const Matrix<2, 2, T>& m) {
+    return m.inverse();
+}
+
+// Adjugate over determinant. The formulas are written for row-major storage;
+// inverse(A^T) = inverse(A)^T, so they work unchanged on column-major data.
+template<typename T>
+constexpr Matrix<3, 3, T> m_invert(const Matrix<3, 3, T>& m) {
+    const T* a = m.data;
+    const T c0 = a[4]*a[8] - a[5]*a[7], c1 = a[5]*a[6] - a[3]*a[8], c2 = a[3]*a[7] - a[4]*a[6];
+    const T inv = T(1) / (a[0]*c0 + a[1]*c1 + a[2]*c2);
+    return Matrix<3, 3, T>(c0*inv, (a[2]*a[7] - a[1]*a[8])*inv, (a[1]*a[5] - a[2]*a[4])*inv,
+                           c1*inv, (a[0]*a[8] - a[2]*a[6])*inv, (a[2]*a[3] - a[0]*a[5])*inv,
+                           c2*inv, (a[1]*a[6] - a[0]*a[7])*inv, (a[0]*a[4] - a[1]*a[3])*inv);
+}
+
+// Same, with the cofactors built from the 2x2 determinants of the upper (s)
+// and lower (c) two rows
+template<typename T>
+constexpr Matrix<4, 4, T> m_invert(const Matrix<4, 4, T>& m) {
+    const T* a = m.data;
+    const T s0 = a[0]*a[5] - a[4]*a[1], s1 = a[0]*a[6] - a[4]*a[2], s2 = a[0]*a[7] - a[4]*a[3];
+    const T s3 = a[1]*a[6] - a[5]*a[2], s4 = a[1]*a[7] - a[5]*a[3], s5 = a[2]*a[7] - a[6]*a[3];
+    const T c0 = a[8]*a[13] - a[12]*a[9],  c1 = a[8]*a[14] - a[12]*a[10], c2 = a[8]*a[15] - a[12]*a[11];
+    const T c3 = a[9]*a[14] - a[13]*a[10], c4 = a[9]*a[15] - a[13]*a[11], c5 = a[10]*a[15] - a[14]*a[11];
+    const T inv = T(1) / (s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0);
+    return Matrix<4, 4, T>(( a[5]*c5 - a[6]*c4 + a[7]*c3)*inv,   (-a[1]*c5 + a[2]*c4 - a[3]*c3)*inv,
+                           ( a[13]*s5 - a[14]*s4 + a[15]*s3)*inv, (-a[9]*s5 + a[10]*s4 - a[11]*s3)*inv,
+                           (-a[4]*c5 + a[6]*c2 - a[7]*c1)*inv,   ( a[0]*c5 - a[2]*c2 + a[3]*c1)*inv,
+                           (-a[12]*s5 + a[14]*s2 - a[15]*s1)*inv, ( a[8]*s5 - a[10]*s2 + a[11]*s1)*inv,
+                           ( a[4]*c4 - a[5]*c2 + a[7]*c0)*inv,   (-a[0]*c4 + a[1]*c2 - a[3]*c0)*inv,
+                           ( a[12]*s4 - a[13]*s2 + a[15]*s0)*inv, (-a[8]*s4 + a[9]*s2 - a[11]*s0)*inv,
+                           (-a[4]*c3 + a[5]*c1 - a[6]*c0)*inv,   ( a[0]*c3 - a[1]*c1 + a[2]*c0)*inv,
+                           (-a[12]*s3 + a[13]*s1 - a[14]*s0)*inv, ( a[8]*s3 - a[9]*s1 + a[10]*s0)*inv);
+}
+
+// Inverse of an affine transform [R t; 0 1]: the last row is (0, 0, 0, 1) and
+// t is in column 3, so that m * (p, 1) moves p as in transform_points. The
+// result is [R^-1, -R^-1 t; 0 1], a 3x3 inverse instead of a 4x4 one.
+// Matrix4(MATRIX_TRANSLATION, p) has its translation in the last row instead
+// and is rejected.
+template<typename T>
+constexpr Matrix<4, 4, T> m_invert_affine(const Matrix<4, 4, T>& m) {
+    const T* a = m.data;
+    assert(a[3] == T(0) && a[7] == T(0) && a[11] == T(0) && a[15] == T(1));
+    const Matrix<3, 3, T> ri = m_invert(Matrix<3, 3, T>(a[0], a[1], a[2], a[4], a[5], a[6], a[8], a[9], a[10]));
+    const Vector<3, T> t = ri * Vector<3, T>(a[12], a[13], a[14]);
+    return Matrix<4, 4, T>(ri[0], ri[1], ri[2], 0,
+                           ri[3], ri[4], ri[5], 0,
+                           ri[6], ri[7], ri[8], 0,
+                           -t[0], -t[1], -t[2], 1);
+}
+
+///////////// SIMD kernels for Vector<4,T> and Matrix<4,4,T> /////////////
+// For T = float and double (simd::float4, simd::double4). These overloads are
+// more specialized than the generic templates above, so plain 4-component
+// operands use them; expressions still go through matrix_expr. Column-major
+// layout as everywhere else: column j of a Matrix<4,4,T> is data[4*j .. 4*j+3].
+#ifdef MATRIX_SIMD
+
+namespace matrix_detail {
+
+template<typename T> struct simd4 : std::false_type {};
+template<> struct simd4<float> : std::true_type {};
+template<> struct simd4<double> : std::true_type {};
+
+template<typename T, typename R>
+using if_simd4_t = typename std::enable_if<simd4<T>::value, R>::type;
+
+// c = a*b for column-major 4x4 arrays: column j of c is the combination of
+// the columns of a weighted by column j of b
+template<typename T>
+inline void mul4x4(const T* a, const T* b, T* c) {
+    using namespace simd;
+    const auto a0 = load(a), a1 = load(a + 4), a2 = load(a + 8), a3 = load(a + 12);
+    for(int j = 0; j < 4; ++j) {
+        auto r = mul(a0, set1(b[4*j]));
+        r = madd(a1, set1(b[4*j + 1]), r);
+        r = madd(a2, set1(b[4*j + 2]), r);
+        r = madd(a3, set1(b[4*j + 3]), r);
+        store(c + 4*j, r);
+    }
+}
+
+#if defined(__AVX__)
+inline void mul4x4(const float* a, const float* b, float* c) {
+    // two result columns per iteration, one in each 128-bit half
+    const __m256 a0 = _mm256_broadcast_ps((const __m128*)a),     a1 = _mm256_broadcast_ps((const __m128*)(a + 4));
+    const __m256 a2 = _mm256_broadcast_ps((const __m128*)(a + 8)), a3 = _mm256_broadcast_ps((const __m128*)(a + 12));
+    for(int j = 0; j < 4; j += 2) {
+        const __m256 bj = _mm256_loadu_ps(b + 4*j);
+        __m256 r = _mm256_mul_ps(a0, _mm256_permute_ps(bj, _MM_SHUFFLE(0, 0, 0, 0)));
+#ifdef __FMA__
+        r = _mm256_fmadd_ps(a1, _mm256_permute_ps(bj, _MM_SHUFFLE(1, 1, 1, 1)), r);
+        r = _mm256_fmadd_ps(a2, _mm256_permute_ps(bj, _MM_SHUFFLE(2, 2, 2, 2)), r);
+        r = _mm256_fmadd_ps(a3, _mm256_permute_ps(bj, _MM_SHUFFLE(3, 3, 3, 3)), r);
+#else
+        r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_permute_ps(bj, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(bj, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(bj, _MM_SHUFFLE(3, 3, 3, 3))));
+#endif
+        _mm256_storeu_ps(c + 4*j, r);
+    }
+}
+#endif
+
+} //namespace matrix_detail
+
+inline Vector4f m_fromsimd(simd::float4 v) { Vector4f r; simd::store(r.data, v); return r; }
+inline Vector4d m_fromsimd(simd::double4 v) { Vector4d r; simd::store(r.data, v); return r; }
+
+#define vec4_t Vector<4, T>
+#define mat4_t Matrix<4, 4, T>
+#define simd4_t(R) matrix_detail::if_simd4_t<T, R>
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator+(const vec4_t& a, const vec4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Binary<std::plus<>, vec4_t, vec4_t>(a, b));
+    return m_fromsimd(simd::add(simd::load(a.data), simd::load(b.data)));
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator-(const vec4_t& a, const vec4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Binary<std::minus<>, vec4_t, vec4_t>(a, b));
+    return m_fromsimd(simd::sub(simd::load(a.data), simd::load(b.data)));
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator-(const vec4_t& a) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Negate<vec4_t>(a));
+    return m_fromsimd(simd::neg(simd::load(a.data)));
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator*(const vec4_t& v, T s) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::ScalarRight<std::multiplies<>, vec4_t, T>(v, s));
+    return m_fromsimd(simd::mul(simd::load(v.data), simd::set1(s)));
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator*(T s, const vec4_t& v) { return v*s; }
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator*(const vec4_t& a, const vec4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Binary<std::multiplies<>, vec4_t, vec4_t>(a, b));
+    return m_fromsimd(simd::mul(simd::load(a.data), simd::load(b.data)));
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator/(const vec4_t& a, const vec4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Binary<std::divides<>, vec4_t, vec4_t>(a, b));
+    return m_fromsimd(simd::div(simd::load(a.data), simd::load(b.data)));
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator/(const vec4_t& v, T s) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::ScalarRight<std::divides<>, vec4_t, T>(v, s));
+    return m_fromsimd(simd::div(simd::load(v.data), simd::set1(s)));
+}
+
+template<typename T> inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t&) operator+=(vec4_t& a, const vec4_t& b) { return a = a + b; }
+template<typename T> inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t&) operator-=(vec4_t& a, const vec4_t& b) { return a = a - b; }
+template<typename T> inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t&) operator*=(vec4_t& v, T s)           { return v = v * s; }
+template<typename T> inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t&) operator*=(vec4_t& a, const vec4_t& b) { return a = a * b; }
+template<typename T> inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t&) operator/=(vec4_t& a, const vec4_t& b) { return a = a / b; }
+template<typename T> inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t&) operator/=(vec4_t& v, T s)           { return v = v / s; }
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(T) m_dot(const vec4_t& a, const vec4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3]);
+    return simd::first(simd::hsum(simd::mul(simd::load(a.data), simd::load(b.data))));
+}
+
+inline MATRIX_SIMD_CONSTEXPR Vector4f m_cross(const Vector4f& a, const Vector4f& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(Vector4f(a[1]*b[2]-a[2]*b[1], a[2]*b[0]-a[0]*b[2], a[0]*b[1]-a[1]*b[0], 0));
+    using namespace simd;
+    const float4 va = load(a.data), vb = load(b.data);
+    // a * b.yzx - a.yzx * b gives the cross product in zxy order
+    const float4 c = sub(mul(va, shuffle<1, 2, 0, 3>(vb)), mul(shuffle<1, 2, 0, 3>(va), vb));
+    Vector4f result = m_fromsimd(shuffle<1, 2, 0, 3>(c));
+    result.w = 0; // w*w - w*w may not be exactly 0 once contracted to an fma
     return result;
 }
 
 template<typename T>
-Vector<2,T> operator*(const Matrix<2,2,T>& m, const Vector<2,T>& b) { return m.a1*b.x + m.a2*b.y; }
+inline simd4_t(T) m_length(const vec4_t& v) { return std::sqrt(m_dot(v, v)); }
+
 template<typename T>
-Vector<3,T> operator*(const Matrix<3,3,T>& m, const Vector<3,T>& b) { return m.a1*b.x + m.a2*b.y + m.a3*b.z; }
+inline simd4_t(vec4_t) m_normalize(const vec4_t& v) {
+    const auto x = simd::load(v.data);
+    return m_fromsimd(simd::div(x, simd::sqrt(simd::hsum(simd::mul(x, x)))));
+}
+
 template<typename T>
-Vector<4,T> operator*(const Matrix<4,4,T>& m, const Vector<4,T>& b) { return m.a1*b.x + m.a2*b.y + m.a3*b.z + m.a4*b.w; }
+inline MATRIX_SIMD_CONSTEXPR simd4_t(vec4_t) operator*(const mat4_t& m, const vec4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Product<mat4_t, vec4_t>(m, b));
+    using namespace simd;
+    auto r = mul(load(m.data), set1(b.data[0]));
+    r = madd(load(m.data + 4), set1(b.data[1]), r);
+    r = madd(load(m.data + 8), set1(b.data[2]), r);
+    r = madd(load(m.data + 12), set1(b.data[3]), r);
+    return m_fromsimd(r);
+}
 
-template <int n, typename T>
-inline float m_length(const Vector<n, T>& v) {
-    float result = sqrt(m_dot(v, v));
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(mat4_t) operator*(const mat4_t& a, const mat4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Product<mat4_t, mat4_t>(a, b));
+    mat4_t result{};
+    matrix_detail::mul4x4(a.data, b.data, result.data);
     return result;
 }
 
-template <int n, typename T>
-inline Vector<n, T> m_normalize(const Vector<n,T>& v) {
-    Vector<n, T> result = v / m_length(v);
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(mat4_t) operator+(const mat4_t& a, const mat4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Binary<std::plus<>, mat4_t, mat4_t>(a, b));
+    mat4_t result{};
+    for(int j = 0; j < 16; j += 4)
+        simd::store(result.data + j, simd::add(simd::load(a.data + j), simd::load(b.data + j)));
+    return result;
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(mat4_t) operator-(const mat4_t& a, const mat4_t& b) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Binary<std::minus<>, mat4_t, mat4_t>(a, b));
+    mat4_t result{};
+    for(int j = 0; j < 16; j += 4)
+        simd::store(result.data + j, simd::sub(simd::load(a.data + j), simd::load(b.data + j)));
+    return result;
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(mat4_t) operator-(const mat4_t& a) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::Negate<mat4_t>(a));
+    mat4_t result{};
+    for(int j = 0; j < 16; j += 4)
+        simd::store(result.data + j, simd::neg(simd::load(a.data + j)));
     return result;
 }
 
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(mat4_t) operator*(const mat4_t& a, T s) {
+    MATRIX_IF_CONSTANT_EVALUATED(matrix_expr::ScalarRight<std::multiplies<>, mat4_t, T>(a, s));
+    mat4_t result{};
+    const auto vs = simd::set1(s);
+    for(int j = 0; j < 16; j += 4)
+        simd::store(result.data + j, simd::mul(simd::load(a.data + j), vs));
+    return result;
+}
+
+template<typename T>
+inline MATRIX_SIMD_CONSTEXPR simd4_t(mat4_t) operator*(T s, const mat4_t& a) { return a*s; }
+
+#undef vec4_t
+#undef mat4_t
+#undef simd4_t
+
+#endif // MATRIX_SIMD
+
 ///////////// Util functions for vector and matrix /////////////
 template<int n, typename T>
 std::ostream& operator<<(std::ostream& os, const Vector<n, T>& vec) {
@@ -627,4 +1308,9 @@ std::ostream& operator<<(std::ostream& os, const Matrix<r,c, T>& mat) {
     return os;
 }
 
+template<typename E>
+auto operator<<(std::ostream& os, const E& e) -> typename std::enable_if<matrix_expr::is_node<E>::value, std::ostream&>::type {
+    return os << e.eval();
+}
+
 #endif // MATRIX_H
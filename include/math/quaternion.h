@@ -0,0 +1,505 @@
+#ifndef QUATERNION_H
+#define QUATERNION_H
+
+#include <cmath>
+#include <cstddef>
+
+#include "matrix.h"
+#include "vector_soa.h"
+
+// Rotations as unit quaternions q = (x, y, z, w) = (sin(a/2) * axis, cos(a/2)),
+// and rigid transforms (rotation then translation) as unit dual quaternions.
+// Composing two rotations is 16 multiplies instead of 27 for Matrix3f, and
+// they interpolate without drifting away from a rotation.
+//
+// Rotations are counterclockwise about the axis, and m_tomatrix3(q) * v equals
+// m_rotate(q, v). The angle constructors of Matrix3f/Matrix4f rotate the
+// other way: Quaternion<>(axis, a) matches Matrix3f(MATRIX_ROTATION, axis, -a).
+template<typename T = float>
+struct MATRIX_ALIGN(T) Quaternion {
+    union {
+        T data[4];
+        struct { T x, y, z, w; };
+        Vector<3, T> xyz;
+        Vector<4, T> xyzw;
+    };
+    constexpr T& operator[](int i) { return data[i]; }
+    constexpr const T& operator[](int i) const { return data[i]; }
+
+    Quaternion() = default;
+    constexpr Quaternion(T x, T y, T z, T w) : data{x, y, z, w} { }
+    // rotation by 'angle' radians about 'axis', which need not be normalized
+    Quaternion(const Vector<3, T>& axis, matrix_detail::real_t<T> angle);
+
+    static constexpr Quaternion identity() { return Quaternion(0, 0, 0, 1); }
+};
+
+// Rotation and translation: p -> m_rotate(real, p) + t, with dual = t * real / 2
+// where t is the quaternion (t, 0)
+template<typename T = float>
+struct DualQuaternion {
+    Quaternion<T> real, dual;
+
+    DualQuaternion() = default;
+    constexpr DualQuaternion(const Quaternion<T>& real, const Quaternion<T>& dual) : real(real), dual(dual) { }
+    constexpr DualQuaternion(const Quaternion<T>& rotation, const Vector<3, T>& translation);
+
+    static constexpr DualQuaternion identity() { return DualQuaternion(Quaternion<T>::identity(), Quaternion<T>(0, 0, 0, 0)); }
+};
+
+using Quaternionf = Quaternion<float>;
+using Quaterniond = Quaternion<double>;
+using DualQuaternionf = DualQuaternion<float>;
+using DualQuaterniond = DualQuaternion<double>;
+
+#define quat_t Quaternion<T>
+#define dquat_t DualQuaternion<T>
+
+template<typename T>
+Quaternion<T>::Quaternion(const Vector<3, T>& axis, matrix_detail::real_t<T> angle) : data{} {
+    const matrix_detail::real_t<T> len = std::sqrt(axis.data[0]*axis.data[0] + axis.data[1]*axis.data[1] + axis.data[2]*axis.data[2]);
+    const matrix_detail::real_t<T> s = std::sin(angle / 2) / len;
+    data[0] = axis.data[0]*s;
+    data[1] = axis.data[1]*s;
+    data[2] = axis.data[2]*s;
+    data[3] = std::cos(angle / 2);
+}
+
+///////////// Quaternion functions /////////////
+
+// Hamilton product: rotating by a*b rotates by b, then by a
+template<typename T>
+constexpr quat_t operator*(const quat_t& a, const quat_t& b) {
+    return quat_t(a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1],
+                  a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0],
+                  a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3],
+                  a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2]);
+}
+
+template<typename T>
+constexpr quat_t operator+(const quat_t& a, const quat_t& b) { return quat_t(a[0] + b[0], a[1] + b[1], a[2] + b[2], a[3] + b[3]); }
+
+template<typename T>
+constexpr quat_t operator-(const quat_t& a, const quat_t& b) { return quat_t(a[0] - b[0], a[1] - b[1], a[2] - b[2], a[3] - b[3]); }
+
+template<typename T>
+constexpr quat_t operator-(const quat_t& q) { return quat_t(-q[0], -q[1], -q[2], -q[3]); }
+
+template<typename T>
+constexpr quat_t operator*(const quat_t& q, T s) { return quat_t(q[0]*s, q[1]*s, q[2]*s, q[3]*s); }
+
+template<typename T>
+constexpr quat_t operator*(T s, const quat_t& q) { return q*s; }
+
+template<typename T>
+constexpr T m_dot(const quat_t& a, const quat_t& b) { return a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3]; }
+
+template<typename T>
+T m_length(const quat_t& q) { return std::sqrt(m_dot(q, q)); }
+
+template<typename T>
+quat_t m_normalize(const quat_t& q) { return q * (T(1) / m_length(q)); }
+
+// The inverse of a unit quaternion
+template<typename T>
+constexpr quat_t m_conjugate(const quat_t& q) { return quat_t(-q[0], -q[1], -q[2], q[3]); }
+
+template<typename T>
+constexpr quat_t m_invert(const quat_t& q) { return m_conjugate(q) * (T(1) / m_dot(q, q)); }
+
+// v rotated by the unit quaternion q: v + 2 q.xyz x (q.xyz x v + q.w v),
+// 18 multiplies
+template<typename T>
+constexpr Vector<3, T> m_rotate(const quat_t& q, const Vector<3, T>& v) {
+    const T ux = q[1]*v[2] - q[2]*v[1] + q[3]*v[0];
+    const T uy = q[2]*v[0] - q[0]*v[2] + q[3]*v[1];
+    const T uz = q[0]*v[1] - q[1]*v[0] + q[3]*v[2];
+    return Vector<3, T>(v[0] + 2*(q[1]*uz - q[2]*uy),
+                        v[1] + 2*(q[2]*ux - q[0]*uz),
+                        v[2] + 2*(q[0]*uy - q[1]*ux));
+}
+
+// Normalized linear interpolation along the shorter arc. Not constant speed
+// in t, but cheap and close to m_slerp for the small steps of an animation.
+template<typename T>
+quat_t m_nlerp(const quat_t& a, const quat_t& b, T t) {
+    const T tb = m_dot(a, b) < 0 ? -t : t;
+    return m_normalize(a*(1 - t) + b*tb);
+}
+
+// Spherical linear interpolation along the shorter arc, at constant angular
+// speed in t
+template<typename T>
+quat_t m_slerp(const quat_t& a, const quat_t& b, T t) {
+    T d = m_dot(a, b);
+    const T sign = d < 0 ? -1 : 1;
+    d *= sign;
+    if(d > T(0.9995)) return m_nlerp(a, b, t); // sin(angle) ~ 0
+    const T angle = std::acos(d), s = 1 / std::sin(angle);
+    return a*(std::sin((1 - t)*angle)*s) + b*(sign*std::sin(t*angle)*s);
+}
+
+// Column-major rotation matrices, see the note on Quaternion
+template<typename T>
+constexpr Matrix<3, 3, T> m_tomatrix3(const quat_t& q) {
+    const T x2 = q[0]*2, y2 = q[1]*2, z2 = q[2]*2;
+    const T xx = q[0]*x2, yy = q[1]*y2, zz = q[2]*z2, xy = q[0]*y2, xz = q[0]*z2, yz = q[1]*z2;
+    const T wx = q[3]*x2, wy = q[3]*y2, wz = q[3]*z2;
+    return Matrix<3, 3, T>(1 - yy - zz, xy + wz,     xz - wy,
+                           xy - wz,     1 - xx - zz, yz + wx,
+                           xz + wy,     yz - wx,     1 - xx - yy);
+}
+
+template<typename T>
+constexpr Matrix<4, 4, T> m_tomatrix4(const quat_t& q) {
+    const Matrix<3, 3, T> r = m_tomatrix3(q);
+    return Matrix<4, 4, T>(r[0], r[1], r[2], 0,
+                           r[3], r[4], r[5], 0,
+                           r[6], r[7], r[8], 0,
+                           0,    0,    0,    1);
+}
+
+// Unit quaternion of a rotation matrix, from the largest of w, x, y, z for
+// accuracy (Shepperd's method)
+template<typename T>
+quat_t m_toquaternion(const Matrix<3, 3, T>& m) {
+    // mrc is row r, column c
+    const T m00 = m[0], m10 = m[1], m20 = m[2], m01 = m[3], m11 = m[4], m21 = m[5], m02 = m[6], m12 = m[7], m22 = m[8];
+    const T trace = m00 + m11 + m22;
+    if(trace > 0) {
+        const T s = std::sqrt(trace + 1) * 2;
+        return quat_t((m21 - m12) / s, (m02 - m20) / s, (m10 - m01) / s, s / 4);
+    }
+    if(m00 > m11 && m00 > m22) {
+        const T s = std::sqrt(1 + m00 - m11 - m22) * 2;
+        return quat_t(s / 4, (m01 + m10) / s, (m02 + m20) / s, (m21 - m12) / s);
+    }
+    if(m11 > m22) {
+        const T s = std::sqrt(1 + m11 - m00 - m22) * 2;
+        return quat_t((m01 + m10) / s, s / 4, (m12 + m21) / s, (m02 - m20) / s);
+    }
+    const T s = std::sqrt(1 + m22 - m00 - m11) * 2;
+    return quat_t((m02 + m20) / s, (m12 + m21) / s, s / 4, (m10 - m01) / s);
+}
+
+// Rotation of the upper 3x3 block; the translation is ignored
+template<typename T>
+quat_t m_toquaternion(const Matrix<4, 4, T>& m) {
+    return m_toquaternion(Matrix<3, 3, T>(m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10]));
+}
+
+///////////// Dual quaternion functions /////////////
+
+template<typename T>
+constexpr DualQuaternion<T>::DualQuaternion(const quat_t& rotation, const Vector<3, T>& translation)
+    : real(rotation), dual(quat_t(translation[0], translation[1], translation[2], 0) * rotation * T(0.5))
+{
+}
+
+// Transforming by a*b transforms by b, then by a
+template<typename T>
+constexpr dquat_t operator*(const dquat_t& a, const dquat_t& b) {
+    return dquat_t(a.real*b.real, a.real*b.dual + a.dual*b.real);
+}
+
+template<typename T>
+constexpr dquat_t operator+(const dquat_t& a, const dquat_t& b) { return dquat_t(a.real + b.real, a.dual + b.dual); }
+
+template<typename T>
+constexpr dquat_t operator*(const dquat_t& q, T s) { return dquat_t(q.real*s, q.dual*s); }
+
+template<typename T>
+constexpr dquat_t operator*(T s, const dquat_t& q) { return q*s; }
+
+// The inverse of a unit dual quaternion
+template<typename T>
+constexpr dquat_t m_conjugate(const dquat_t& q) { return dquat_t(m_conjugate(q.real), m_conjugate(q.dual)); }
+
+// Rescales to a unit rotation part. Enough after blending (m_dlb); q.dual is
+// not made orthogonal to q.real.
+template<typename T>
+dquat_t m_normalize(const dquat_t& q) { return q * (T(1) / m_length(q.real)); }
+
+template<typename T>
+constexpr Vector<3, T> m_translation(const dquat_t& q) {
+    const quat_t t = q.dual * m_conjugate(q.real);
+    return Vector<3, T>(2*t[0], 2*t[1], 2*t[2]);
+}
+
+// p transformed by the unit dual quaternion q
+template<typename T>
+constexpr Vector<3, T> m_transform(const dquat_t& q, const Vector<3, T>& p) {
+    const Vector<3, T> r = m_rotate(q.real, p), t = m_translation(q);
+    return Vector<3, T>(r[0] + t[0], r[1] + t[1], r[2] + t[2]);
+}
+
+// Dual quaternion linear blending of 'count' transforms: the normalized
+// weighted sum, each term turned to the same hemisphere as the first.
+// Unlike blending matrices, this does not shrink the skin around joints.
+template<typename T>
+dquat_t m_dlb(const dquat_t* q, const T* weights, std::size_t count) {
+    dquat_t result(quat_t(0, 0, 0, 0), quat_t(0, 0, 0, 0));
+    for(std::size_t k = 0; k < count; ++k) {
+        const T w = m_dot(q[0].real, q[k].real) < 0 ? -weights[k] : weights[k];
+        result = result + q[k]*w;
+    }
+    return m_normalize(result);
+}
+
+// Affine transform matrix with the translation in column 3, as used by
+// transform_points and m_invert_affine
+template<typename T>
+constexpr Matrix<4, 4, T> m_tomatrix4(const dquat_t& q) {
+    Matrix<4, 4, T> m = m_tomatrix4(q.real);
+    const Vector<3, T> t = m_translation(q);
+    m[12] = t[0];
+    m[13] = t[1];
+    m[14] = t[2];
+    return m;
+}
+
+// Rigid transform of an affine matrix [R t; 0 1] with t in column 3
+template<typename T>
+dquat_t m_todualquaternion(const Matrix<4, 4, T>& m) {
+    return dquat_t(m_toquaternion(m), Vector<3, T>(m[12], m[13], m[14]));
+}
+
+#undef quat_t
+#undef dquat_t
+
+///////////// Batch functions on quaternions /////////////
+// Quaternion batches are VectorSoA<4> streams of x, y, z and w. The kernels
+// work like those of vector_soa.h: simd::Wide<float> for the bulk and
+// simd::Scalar<float> for the tail, all inputs of an element are loaded
+// before its outputs are stored.
+
+namespace quat_detail {
+
+using soa_detail::WideOps;
+using soa_detail::ScalarOps;
+
+// Hamilton product of one vector of quaternions each
+template<typename Ops, typename V = typename Ops::type>
+void multiply(const V* a, const V* b, V* out) {
+    out[0] = Ops::sub(Ops::madd(a[3], b[0], Ops::madd(a[0], b[3], Ops::mul(a[1], b[2]))), Ops::mul(a[2], b[1]));
+    out[1] = Ops::sub(Ops::madd(a[3], b[1], Ops::madd(a[1], b[3], Ops::mul(a[2], b[0]))), Ops::mul(a[0], b[2]));
+    out[2] = Ops::sub(Ops::madd(a[3], b[2], Ops::madd(a[0], b[1], Ops::mul(a[2], b[3]))), Ops::mul(a[1], b[0]));
+    out[3] = Ops::sub(Ops::mul(a[3], b[3]), Ops::madd(a[0], b[0], Ops::madd(a[1], b[1], Ops::mul(a[2], b[2]))));
+}
+
+template<typename Ops, typename V = typename Ops::type>
+V dot(const V* a, const V* b) {
+    return Ops::madd(a[0], b[0], Ops::madd(a[1], b[1], Ops::madd(a[2], b[2], Ops::mul(a[3], b[3]))));
+}
+
+template<typename Ops>
+std::size_t composeKernel(const float* const* a, const float* const* b, float* const* out, std::size_t i, std::size_t end) {
+    using V = typename Ops::type;
+    for(; i + Ops::width <= end; i += Ops::width) {
+        V qa[4], qb[4], r[4];
+        for(int k = 0; k < 4; ++k) {
+            qa[k] = Ops::loadu(a[k] + i);
+            qb[k] = Ops::loadu(b[k] + i);
+        }
+        multiply<Ops>(qa, qb, r);
+        for(int k = 0; k < 4; ++k) Ops::storeu(out[k] + i, r[k]);
+    }
+    return i;
+}
+
+template<typename Ops>
+std::size_t nlerpKernel(const float* const* a, const float* const* b, const float* t, float* const* out,
+                        std::size_t i, std::size_t end) {
+    using V = typename Ops::type;
+    const V one = Ops::set1(1.0f);
+    for(; i + Ops::width <= end; i += Ops::width) {
+        V qa[4], qb[4], r[4];
+        for(int k = 0; k < 4; ++k) {
+            qa[k] = Ops::loadu(a[k] + i);
+            qb[k] = Ops::loadu(b[k] + i);
+        }
+        const V tv = Ops::loadu(t + i), ta = Ops::sub(one, tv), tb = Ops::mulsign(tv, dot<Ops>(qa, qb));
+        for(int k = 0; k < 4; ++k) r[k] = Ops::madd(qa[k], ta, Ops::mul(qb[k], tb));
+        const V inv = Ops::div(one, Ops::sqrt(dot<Ops>(r, r)));
+        for(int k = 0; k < 4; ++k) Ops::storeu(out[k] + i, Ops::mul(r[k], inv));
+    }
+    return i;
+}
+
+// sin(t*angle)/sin(angle) as a polynomial in t and cos(angle), after
+// D. Eberly, "A Fast and Accurate Algorithm for Computing SLERP": the series
+// t * (1 + b1*(1 + b2*(1 + ...))) with b_i = (t^2 - i^2) / (i*(2i+1)) *
+// (cos(angle) - 1), cut at 12 terms with the last one scaled to balance the
+// truncation error. Only mul and add, no branches; the weights are within
+// 7.2e-7 of the exact ones for cos(angle) >= 0 (8 terms would give 1.9e-5).
+struct SlerpCoefficients {
+    static constexpr int terms = 12;
+    static constexpr float scale = 1.8938f;
+    static constexpr float u(int i) { return (i == terms ? scale : 1.0f) / (i * (2*i + 1)); }
+    static constexpr float v(int i) { return (i == terms ? scale : 1.0f) * i / (2*i + 1); }
+};
+
+template<typename Ops, typename V = typename Ops::type>
+V slerpWeight(V t, V cosm1) {
+    using C = SlerpCoefficients;
+    const V one = Ops::set1(1.0f), t2 = Ops::mul(t, t);
+    V c = one;
+    for(int k = C::terms; k >= 1; --k)
+        c = Ops::madd(Ops::mul(Ops::madd(Ops::set1(C::u(k)), t2, Ops::set1(-C::v(k))), cosm1), c, one);
+    return Ops::mul(t, c);
+}
+
+template<typename Ops>
+std::size_t slerpKernel(const float* const* a, const float* const* b, const float* t, float* const* out,
+                        std::size_t i, std::size_t end) {
+    using V = typename Ops::type;
+    const V one = Ops::set1(1.0f);
+    for(; i + Ops::width <= end; i += Ops::width) {
+        V qa[4], qb[4];
+        for(int k = 0; k < 4; ++k) {
+            qa[k] = Ops::loadu(a[k] + i);
+            qb[k] = Ops::loadu(b[k] + i);
+        }
+        // interpolate towards -b when the dot is negative: the shorter arc
+        const V d = dot<Ops>(qa, qb), cosm1 = Ops::sub(Ops::mulsign(d, d), one);
+        const V tv = Ops::loadu(t + i);
+        const V wa = slerpWeight<Ops>(Ops::sub(one, tv), cosm1);
+        const V wb = Ops::mulsign(slerpWeight<Ops>(tv, cosm1), d);
+        for(int k = 0; k < 4; ++k) Ops::storeu(out[k] + i, Ops::madd(qa[k], wa, Ops::mul(qb[k], wb)));
+    }
+    return i;
+}
+
+// out = m_transform(m_dlb(bones[index[0..influences)], weight[...]), in):
+// the blend gathers bones one lane at a time into blended[8][Ops::width],
+// normalizing and transforming run on whole vectors
+template<typename Ops, int influences, typename In, typename Out>
+std::size_t skinKernel(const DualQuaternion<float>* bones, const int* const* index, const float* const* weight,
+                       const In* const* in, Out* const* out, std::size_t i, std::size_t end) {
+    using V = typename Ops::type;
+    alignas(64) float blended[8][Ops::width];
+    for(; i + Ops::width <= end; i += Ops::width) {
+        for(int l = 0; l < Ops::width; ++l) {
+            float q[8] = {};
+            const Quaternion<float>& first = bones[index[0][i + l]].real;
+            for(int k = 0; k < influences; ++k) {
+                const DualQuaternion<float>& b = bones[index[k][i + l]];
+                const float w = m_dot(first, b.real) < 0 ? -weight[k][i + l] : weight[k][i + l];
+                for(int c = 0; c < 4; ++c) {
+                    q[c] += b.real[c]*w;
+                    q[c + 4] += b.dual[c]*w;
+                }
+            }
+            for(int c = 0; c < 8; ++c) blended[c][l] = q[c];
+        }
+
+        V r[4], d[4], p[3];
+        for(int c = 0; c < 4; ++c) {
+            r[c] = Ops::load(blended[c]);
+            d[c] = Ops::load(blended[c + 4]);
+        }
+        const V inv = Ops::div(Ops::set1(1.0f), Ops::sqrt(dot<Ops>(r, r)));
+        for(int c = 0; c < 4; ++c) {
+            r[c] = Ops::mul(r[c], inv);
+            d[c] = Ops::mul(d[c], inv);
+        }
+        for(int c = 0; c < 3; ++c) p[c] = Ops::loadu(in[c] + i);
+
+        // u = r.xyz x p + r.w p; p' = p + 2 r.xyz x u + 2 (r.w d.xyz - d.w r.xyz + r.xyz x d.xyz)
+        const V u0 = Ops::madd(r[3], p[0], Ops::sub(Ops::mul(r[1], p[2]), Ops::mul(r[2], p[1])));
+        const V u1 = Ops::madd(r[3], p[1], Ops::sub(Ops::mul(r[2], p[0]), Ops::mul(r[0], p[2])));
+        const V u2 = Ops::madd(r[3], p[2], Ops::sub(Ops::mul(r[0], p[1]), Ops::mul(r[1], p[0])));
+        const V s0 = Ops::add(Ops::sub(Ops::mul(r[1], u2), Ops::mul(r[2], u1)),
+                              Ops::madd(r[3], d[0], Ops::sub(Ops::sub(Ops::mul(r[1], d[2]), Ops::mul(r[2], d[1])), Ops::mul(d[3], r[0]))));
+        const V s1 = Ops::add(Ops::sub(Ops::mul(r[2], u0), Ops::mul(r[0], u2)),
+                              Ops::madd(r[3], d[1], Ops::sub(Ops::sub(Ops::mul(r[2], d[0]), Ops::mul(r[0], d[2])), Ops::mul(d[3], r[1]))));
+        const V s2 = Ops::add(Ops::sub(Ops::mul(r[0], u1), Ops::mul(r[1], u0)),
+                              Ops::madd(r[3], d[2], Ops::sub(Ops::sub(Ops::mul(r[0], d[1]), Ops::mul(r[1], d[0])), Ops::mul(d[3], r[2]))));
+        const V two = Ops::set1(2.0f);
+        Ops::storeu(out[0] + i, Ops::madd(two, s0, p[0]));
+        Ops::storeu(out[1] + i, Ops::madd(two, s1, p[1]));
+        Ops::storeu(out[2] + i, Ops::madd(two, s2, p[2]));
+    }
+    return i;
+}
+
+} //namespace quat_detail
+
+// out[i] = a[i] * b[i]
+inline void batch_compose(const Points4f& a, const Points4f& b, Points4f& out, unsigned threads = 1) {
+    namespace sd = soa_detail;
+    namespace qd = quat_detail;
+    out.resize(a.size());
+    const float* pa[4];
+    const float* pb[4];
+    float* po[4];
+    sd::pointers(a, pa);
+    sd::pointers(b, pb);
+    sd::pointers(out, po);
+    sd::parallelRanges(a.size(), threads, [&](std::size_t begin, std::size_t end) {
+        begin = qd::composeKernel<qd::WideOps>(pa, pb, po, begin, end);
+        qd::composeKernel<qd::ScalarOps>(pa, pb, po, begin, end);
+    });
+}
+
+// out[i] = m_nlerp(a[i], b[i], t[i])
+inline void batch_nlerp(const Points4f& a, const Points4f& b, const float* t, Points4f& out, unsigned threads = 1) {
+    namespace sd = soa_detail;
+    namespace qd = quat_detail;
+    out.resize(a.size());
+    const float* pa[4];
+    const float* pb[4];
+    float* po[4];
+    sd::pointers(a, pa);
+    sd::pointers(b, pb);
+    sd::pointers(out, po);
+    sd::parallelRanges(a.size(), threads, [&](std::size_t begin, std::size_t end) {
+        begin = qd::nlerpKernel<qd::WideOps>(pa, pb, t, po, begin, end);
+        qd::nlerpKernel<qd::ScalarOps>(pa, pb, t, po, begin, end);
+    });
+}
+
+// out[i] = m_slerp(a[i], b[i], t[i]) for unit quaternions and t in [0, 1],
+// to about 1e-6 (see quat_detail::SlerpCoefficients)
+inline void batch_slerp(const Points4f& a, const Points4f& b, const float* t, Points4f& out, unsigned threads = 1) {
+    namespace sd = soa_detail;
+    namespace qd = quat_detail;
+    out.resize(a.size());
+    const float* pa[4];
+    const float* pb[4];
+    float* po[4];
+    sd::pointers(a, pa);
+    sd::pointers(b, pb);
+    sd::pointers(out, po);
+    sd::parallelRanges(a.size(), threads, [&](std::size_t begin, std::size_t end) {
+        begin = qd::slerpKernel<qd::WideOps>(pa, pb, t, po, begin, end);
+        qd::slerpKernel<qd::ScalarOps>(pa, pb, t, po, begin, end);
+    });
+}
+
+// Dual quaternion skinning: point i moves by the blend (m_dlb) of the
+// 'influences' bones index[k][i] with weights weight[k][i]. The weights of a
+// point should sum to 1; unused influences get weight 0 and any valid index.
+// The component types In and Out are float or simd::half.
+template<int influences, typename In, typename Out>
+void skin_points(const DualQuaternion<float>* bones, const VectorSoA<influences, int>& index,
+                 const VectorSoA<influences>& weight, const VectorSoA<3, In>& in, VectorSoA<3, Out>& out,
+                 unsigned threads = 1) {
+    namespace sd = soa_detail;
+    namespace qd = quat_detail;
+    out.resize(in.size());
+    const int* pi[influences];
+    const float* pw[influences];
+    const In* src[3];
+    Out* dst[3];
+    sd::pointers(index, pi);
+    sd::pointers(weight, pw);
+    sd::pointers(in, src);
+    sd::pointers(out, dst);
+    sd::parallelRanges(in.size(), threads, [&](std::size_t begin, std::size_t end) {
+        begin = qd::skinKernel<qd::WideOps, influences>(bones, pi, pw, src, dst, begin, end);
+        qd::skinKernel<qd::ScalarOps, influences>(bones, pi, pw, src, dst, begin, end);
+    });
+}
+
+#endif // QUATERNION_H
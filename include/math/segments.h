@@ -0,0 +1,219 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "vector_soa.h"
+
+// Batched 2D segment intersection. A uniform grid finds the segments that
+// share a cell, and the doIntersect() test runs on those candidates
+// Wide<float>::width pairs at a time. The cost follows the number of segments
+// per cell rather than n^2.
+//
+//     Segments2f s;
+//     s.push_back(Vector4f(p.x, p.y, q.x, q.y));                // p to q
+//     std::vector<Math::SegmentPair> pairs = Math::findIntersections(s);
+//     std::vector<Vector2f> points(pairs.size());
+//     Math::getIntersections(s, pairs, points.data());
+
+// Segment i runs from (x0, y0) to (x1, y1), components 0 to 3 of point i
+using Segments2f = VectorSoA<4>;
+
+namespace Math {
+
+// Indices (i, j) of two crossing segments, i < j
+using SegmentPair = std::pair<std::uint32_t, std::uint32_t>;
+
+namespace segment_detail {
+
+// Each segment is listed in every cell it passes through. The entries of
+// cell c are [start[c], start[c + 1]), in segment order, with the segment's
+// index and a copy of its end points so the narrowphase loads them in a row.
+struct Grid {
+    float originX = 0, originY = 0, invCell = 1;
+    int columns = 1, rows = 1;
+    std::vector<std::uint32_t> start;
+    std::vector<std::uint32_t> index;
+    std::vector<float, AlignedAllocator<float>> coords[4];
+};
+
+// floor(v) clamped to [0, count); truncating is flooring once v >= 0
+inline int clampCell(float v, int count) {
+    return (int)std::min(std::max(v, 0.0f), float(count - 1));
+}
+
+// Calls visit(cell) for every cell the segment passes through, row by row.
+// The ranges are padded by a fraction of a cell so that rounding never drops
+// a segment from a cell it touches.
+template<typename Visit>
+void traverse(const Grid& g, float x0, float y0, float x1, float y1, const Visit& visit) {
+    const float pad = 1e-3f;
+    const float ax = (x0 - g.originX) * g.invCell, ay = (y0 - g.originY) * g.invCell;
+    const float bx = (x1 - g.originX) * g.invCell, by = (y1 - g.originY) * g.invCell;
+    const float xmin = std::min(ax, bx), xmax = std::max(ax, bx);
+    const float ymin = std::min(ay, by), ymax = std::max(ay, by);
+    const float dxdy = ay != by ? (bx - ax) / (by - ay) : 0.0f;
+
+    const int r1 = clampCell(ymax + pad, g.rows);
+    for(int r = clampCell(ymin - pad, g.rows); r <= r1; ++r) {
+        // x at the ends of the part of the segment inside this row
+        const float lo = std::max(float(r) - pad, ymin), hi = std::min(float(r + 1) + pad, ymax);
+        float xa = xmin, xb = xmax;
+        if(ay != by) {
+            xa = std::min(std::max(ax + (lo - ay) * dxdy, xmin), xmax);
+            xb = std::min(std::max(ax + (hi - ay) * dxdy, xmin), xmax);
+        }
+        const int c1 = clampCell(std::max(xa, xb) + pad, g.columns);
+        for(int c = clampCell(std::min(xa, xb) - pad, g.columns); c <= c1; ++c)
+            visit(std::size_t(r) * g.columns + c);
+    }
+}
+
+inline Grid buildGrid(const Segments2f& s) {
+    const std::size_t n = s.size();
+    const float* x0 = s[0];
+    const float* y0 = s[1];
+    const float* x1 = s[2];
+    const float* y1 = s[3];
+
+    float minX = HUGE_VALF, minY = HUGE_VALF, maxX = -HUGE_VALF, maxY = -HUGE_VALF;
+    double extent = 0;
+    for(std::size_t i = 0; i < n; ++i) {
+        minX = std::min(minX, std::min(x0[i], x1[i]));
+        maxX = std::max(maxX, std::max(x0[i], x1[i]));
+        minY = std::min(minY, std::min(y0[i], y1[i]));
+        maxY = std::max(maxY, std::max(y0[i], y1[i]));
+        extent += std::max(std::abs(x1[i] - x0[i]), std::abs(y1[i] - y0[i]));
+    }
+
+    // Cells about as large as an average segment, but no more than about 2n
+    // of them
+    const float w = maxX - minX, h = maxY - minY;
+    float cell = std::max(float(extent / n), std::sqrt(w * h / (2 * n)));
+    cell = std::max(cell, std::max(w, h) / (2 * n));
+    if(!(cell > 0)) cell = 1;
+
+    Grid g;
+    g.originX = minX;
+    g.originY = minY;
+    g.invCell = 1 / cell;
+    g.columns = (int)(w * g.invCell) + 1;
+    g.rows = (int)(h * g.invCell) + 1;
+
+    // Count the entries of every cell, then fill them
+    const std::size_t cells = std::size_t(g.columns) * g.rows;
+    std::vector<std::uint32_t> cursor(cells + 1, 0);
+    for(std::size_t i = 0; i < n; ++i)
+        traverse(g, x0[i], y0[i], x1[i], y1[i], [&](std::size_t c) { ++cursor[c + 1]; });
+    for(std::size_t c = 0; c < cells; ++c) cursor[c + 1] += cursor[c];
+    g.start = cursor;
+
+    const std::size_t entries = cursor[cells];
+    g.index.resize(entries);
+    for(auto& c : g.coords) c.resize(entries);
+    for(std::size_t i = 0; i < n; ++i) {
+        traverse(g, x0[i], y0[i], x1[i], y1[i], [&](std::size_t c) {
+            const std::uint32_t e = cursor[c]++;
+            g.index[e] = (std::uint32_t)i;
+            g.coords[0][e] = x0[i];
+            g.coords[1][e] = y0[i];
+            g.coords[2][e] = x1[i];
+            g.coords[3][e] = y1[i];
+        });
+    }
+    return g;
+}
+
+// Tests entry k against the entries [l, end) of the same cell, Ops::width at
+// a time, with the determinants of doIntersect(); appends the crossing pairs
+// and returns the first untested entry
+template<typename Ops>
+std::size_t crossKernel(const Grid& g, std::size_t k, std::size_t l, std::size_t end, std::vector<SegmentPair>& out) {
+    using V = typename Ops::type;
+    const float* cx0 = g.coords[0].data();
+    const float* cy0 = g.coords[1].data();
+    const float* cx1 = g.coords[2].data();
+    const float* cy1 = g.coords[3].data();
+
+    // this segment, from a to b
+    const V ax = Ops::set1(cx0[k]), ay = Ops::set1(cy0[k]);
+    const V bx = Ops::set1(cx1[k]), by = Ops::set1(cy1[k]);
+    const V ux = Ops::set1(cx1[k] - cx0[k]), uy = Ops::set1(cy1[k] - cy0[k]);
+    const V zero = Ops::set1(0.0f);
+
+    for(; l + Ops::width <= end; l += Ops::width) {
+        // the others, from p to q
+        const V px = Ops::loadu(cx0 + l), py = Ops::loadu(cy0 + l);
+        const V qx = Ops::loadu(cx1 + l), qy = Ops::loadu(cy1 + l);
+        // the other segment's ends on opposite sides of this one's line...
+        const V d1 = Ops::sub(Ops::mul(ux, Ops::sub(py, ay)), Ops::mul(uy, Ops::sub(px, ax)));
+        const V d2 = Ops::sub(Ops::mul(ux, Ops::sub(qy, ay)), Ops::mul(uy, Ops::sub(qx, ax)));
+        // ...and this one's ends on opposite sides of the other's
+        const V vx = Ops::sub(qx, px), vy = Ops::sub(qy, py);
+        const V d3 = Ops::sub(Ops::mul(vx, Ops::sub(ay, py)), Ops::mul(vy, Ops::sub(ax, px)));
+        const V d4 = Ops::sub(Ops::mul(vx, Ops::sub(by, py)), Ops::mul(vy, Ops::sub(bx, px)));
+
+        int hits = Ops::bits(Ops::less(Ops::mul(d1, d2), zero)) & Ops::bits(Ops::less(Ops::mul(d3, d4), zero));
+        for(std::size_t lane = 0; hits; ++lane, hits >>= 1)
+            if(hits & 1) out.emplace_back(g.index[k], g.index[l + lane]);
+    }
+    return l;
+}
+
+} //namespace segment_detail
+
+// All pairs of segments that cross, as doIntersect() decides it: touching,
+// collinear and zero-length segments do not count. Segments that pass within
+// a few ulps of each other's ends may come out differently from
+// doIntersect(), since FMA contraction changes the rounding. The pairs are
+// sorted. 'threads' works as for the batch functions of vector_soa.h.
+inline std::vector<SegmentPair> findIntersections(const Segments2f& s, unsigned threads = 1) {
+    namespace sd = segment_detail;
+    std::vector<SegmentPair> pairs;
+    if(s.size() < 2) return pairs;
+    assert(s.size() <= UINT32_MAX);
+
+    const sd::Grid g = sd::buildGrid(s);
+    std::mutex lock;
+    soa_detail::parallelRanges(g.start.size() - 1, threads, [&](std::size_t begin, std::size_t end) {
+        std::vector<SegmentPair> found;
+        for(std::size_t cell = begin; cell < end; ++cell) {
+            const std::size_t last = g.start[cell + 1];
+            for(std::size_t k = g.start[cell]; k + 1 < last; ++k) {
+                const std::size_t l = sd::crossKernel<soa_detail::WideOps>(g, k, k + 1, last, found);
+                sd::crossKernel<soa_detail::ScalarOps>(g, k, l, last, found);
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        pairs.insert(pairs.end(), found.begin(), found.end());
+    });
+
+    // a pair that shares several cells was found in each of them
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    return pairs;
+}
+
+// The crossing point of every pair from findIntersections(), into out[i]
+inline void getIntersections(const Segments2f& s, const std::vector<SegmentPair>& pairs, Vector2f* out) {
+    for(std::size_t i = 0; i < pairs.size(); ++i) {
+        const Vector4f a = s.get(pairs[i].first), b = s.get(pairs[i].second);
+        const float vx = b.z - b.x, vy = b.w - b.y;
+        // a's ends are at signed distances d0 and d1 (times |v|) from b's line
+        const float d0 = vx * (a.y - b.y) - vy * (a.x - b.x);
+        const float d1 = vx * (a.w - b.y) - vy * (a.z - b.x);
+        const float t = d0 / (d0 - d1);
+        out[i] = Vector2f(a.x + (a.z - a.x) * t, a.y + (a.w - a.y) * t);
+    }
+}
+
+} //namespace Math
+
+#endif // SEGMENTS_H
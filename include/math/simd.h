@@ -0,0 +1,660 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Minimal 4 x float and 4 x double vectors for the Vector<4,T> / Matrix<4,4,T>
+// kernels of matrix.h.
+// SSE on x86 (plus AVX/FMA when enabled), NEON on AArch64. Without either, or
+// with MATRIX_NO_SIMD defined, MATRIX_SIMD stays undefined and matrix.h only
+// uses its scalar templates.
+//
+// With MATRIX_ALIGNED defined, Vector<4,T> and Matrix<4,4,T> are aligned to
+// 4*sizeof(T) and load()/store() use aligned accesses; loadu()/storeu() are
+// for arbitrary pointers.
+//
+// simd::Wide<T> (float, double) is the widest vector of the build, down to
+// simd::Scalar<T> for other types or without SIMD; the batch and GEMM
+// kernels are written against that interface. Wide<float> and Scalar<T> also
+// have the compares, selects and exponent access fast_math.h builds on.
+//
+// simd::half is an IEEE binary16 storage type. Converting it uses F16C on x86
+// (MATRIX_SIMD_HALF) or NEON on AArch64, otherwise a bit-exact software path.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#if !defined(MATRIX_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MATRIX_SIMD
+#define MATRIX_SIMD_SSE
+#include <immintrin.h>
+#elif !defined(MATRIX_NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#define MATRIX_SIMD
+#define MATRIX_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#if (defined(MATRIX_SIMD_SSE) && (defined(__F16C__) || defined(__AVX512F__))) || defined(MATRIX_SIMD_NEON)
+#define MATRIX_SIMD_HALF
+#endif
+
+#ifdef MATRIX_SIMD
+
+namespace simd {
+
+#if defined(MATRIX_SIMD_SSE)
+
+using float4 = __m128;
+
+inline float4 loadu(const float* p) { return _mm_loadu_ps(p); }
+inline void storeu(float* p, float4 v) { _mm_storeu_ps(p, v); }
+#ifdef MATRIX_ALIGNED
+inline float4 load(const float* p) { return _mm_load_ps(p); }
+inline void store(float* p, float4 v) { _mm_store_ps(p, v); }
+#else
+inline float4 load(const float* p) { return _mm_loadu_ps(p); }
+inline void store(float* p, float4 v) { _mm_storeu_ps(p, v); }
+#endif
+
+inline float4 set1(float s) { return _mm_set1_ps(s); }
+inline float4 add(float4 a, float4 b) { return _mm_add_ps(a, b); }
+inline float4 sub(float4 a, float4 b) { return _mm_sub_ps(a, b); }
+inline float4 mul(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+inline float4 div(float4 a, float4 b) { return _mm_div_ps(a, b); }
+inline float4 neg(float4 a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+inline float4 sqrt(float4 a) { return _mm_sqrt_ps(a); }
+
+// a*b + c
+inline float4 madd(float4 a, float4 b, float4 c) {
+#ifdef __FMA__
+    return _mm_fmadd_ps(a, b, c);
+#else
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+// Lane i in all lanes
+template<int i>
+inline float4 splat(float4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(i, i, i, i)); }
+
+// (v[i0], v[i1], v[i2], v[i3])
+template<int i0, int i1, int i2, int i3>
+inline float4 shuffle(float4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(i3, i2, i1, i0)); }
+
+// Sum of the lanes in every lane
+inline float4 hsum(float4 v) {
+    v = _mm_add_ps(v, shuffle<2, 3, 0, 1>(v));
+    return _mm_add_ps(v, shuffle<1, 0, 3, 2>(v));
+}
+
+inline float first(float4 v) { return _mm_cvtss_f32(v); }
+
+#ifdef __AVX__
+
+using double4 = __m256d;
+
+inline double4 loadu(const double* p) { return _mm256_loadu_pd(p); }
+inline void storeu(double* p, double4 v) { _mm256_storeu_pd(p, v); }
+#ifdef MATRIX_ALIGNED
+inline double4 load(const double* p) { return _mm256_load_pd(p); }
+inline void store(double* p, double4 v) { _mm256_store_pd(p, v); }
+#else
+inline double4 load(const double* p) { return _mm256_loadu_pd(p); }
+inline void store(double* p, double4 v) { _mm256_storeu_pd(p, v); }
+#endif
+
+inline double4 set1(double s) { return _mm256_set1_pd(s); }
+inline double4 add(double4 a, double4 b) { return _mm256_add_pd(a, b); }
+inline double4 sub(double4 a, double4 b) { return _mm256_sub_pd(a, b); }
+inline double4 mul(double4 a, double4 b) { return _mm256_mul_pd(a, b); }
+inline double4 div(double4 a, double4 b) { return _mm256_div_pd(a, b); }
+inline double4 neg(double4 a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+inline double4 sqrt(double4 a) { return _mm256_sqrt_pd(a); }
+
+inline double4 madd(double4 a, double4 b, double4 c) {
+#ifdef __FMA__
+    return _mm256_fmadd_pd(a, b, c);
+#else
+    return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+
+inline double4 hsum(double4 v) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    s = _mm_add_pd(s, _mm_shuffle_pd(s, s, 1));
+    return _mm256_insertf128_pd(_mm256_castpd128_pd256(s), s, 1);
+}
+
+inline double first(double4 v) { return _mm_cvtsd_f64(_mm256_castpd256_pd128(v)); }
+
+#else
+
+// Two SSE2 registers
+struct double4 { __m128d lo, hi; };
+
+inline double4 loadu(const double* p) { return {_mm_loadu_pd(p), _mm_loadu_pd(p + 2)}; }
+inline void storeu(double* p, double4 v) { _mm_storeu_pd(p, v.lo); _mm_storeu_pd(p + 2, v.hi); }
+#ifdef MATRIX_ALIGNED
+inline double4 load(const double* p) { return {_mm_load_pd(p), _mm_load_pd(p + 2)}; }
+inline void store(double* p, double4 v) { _mm_store_pd(p, v.lo); _mm_store_pd(p + 2, v.hi); }
+#else
+inline double4 load(const double* p) { return loadu(p); }
+inline void store(double* p, double4 v) { storeu(p, v); }
+#endif
+
+inline double4 set1(double s) { return {_mm_set1_pd(s), _mm_set1_pd(s)}; }
+inline double4 add(double4 a, double4 b) { return {_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)}; }
+inline double4 sub(double4 a, double4 b) { return {_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)}; }
+inline double4 mul(double4 a, double4 b) { return {_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)}; }
+inline double4 div(double4 a, double4 b) { return {_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)}; }
+inline double4 neg(double4 a) { return sub(set1(0.0), a); }
+inline double4 sqrt(double4 a) { return {_mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi)}; }
+inline double4 madd(double4 a, double4 b, double4 c) { return add(mul(a, b), c); }
+
+inline double4 hsum(double4 v) {
+    __m128d s = _mm_add_pd(v.lo, v.hi);
+    s = _mm_add_pd(s, _mm_shuffle_pd(s, s, 1));
+    return {s, s};
+}
+
+inline double first(double4 v) { return _mm_cvtsd_f64(v.lo); }
+
+#endif // __AVX__
+
+#elif defined(MATRIX_SIMD_NEON)
+
+using float4 = float32x4_t;
+
+inline float4 loadu(const float* p) { return vld1q_f32(p); }
+inline void storeu(float* p, float4 v) { vst1q_f32(p, v); }
+inline float4 load(const float* p) { return vld1q_f32(p); }
+inline void store(float* p, float4 v) { vst1q_f32(p, v); }
+
+inline float4 set1(float s) { return vdupq_n_f32(s); }
+inline float4 add(float4 a, float4 b) { return vaddq_f32(a, b); }
+inline float4 sub(float4 a, float4 b) { return vsubq_f32(a, b); }
+inline float4 mul(float4 a, float4 b) { return vmulq_f32(a, b); }
+inline float4 div(float4 a, float4 b) { return vdivq_f32(a, b); }
+inline float4 neg(float4 a) { return vnegq_f32(a); }
+inline float4 sqrt(float4 a) { return vsqrtq_f32(a); }
+inline float4 madd(float4 a, float4 b, float4 c) { return vfmaq_f32(c, a, b); }
+
+template<int i>
+inline float4 splat(float4 v) { return vdupq_laneq_f32(v, i); }
+
+template<int i0, int i1, int i2, int i3>
+inline float4 shuffle(float4 v) {
+    float4 r = {vgetq_lane_f32(v, i0), vgetq_lane_f32(v, i1), vgetq_lane_f32(v, i2), vgetq_lane_f32(v, i3)};
+    return r;
+}
+
+inline float4 hsum(float4 v) { return vdupq_n_f32(vaddvq_f32(v)); }
+
+inline float first(float4 v) { return vgetq_lane_f32(v, 0); }
+
+struct double4 { float64x2_t lo, hi; };
+
+inline double4 loadu(const double* p) { return {vld1q_f64(p), vld1q_f64(p + 2)}; }
+inline void storeu(double* p, double4 v) { vst1q_f64(p, v.lo); vst1q_f64(p + 2, v.hi); }
+inline double4 load(const double* p) { return loadu(p); }
+inline void store(double* p, double4 v) { storeu(p, v); }
+
+inline double4 set1(double s) { return {vdupq_n_f64(s), vdupq_n_f64(s)}; }
+inline double4 add(double4 a, double4 b) { return {vaddq_f64(a.lo, b.lo), vaddq_f64(a.hi, b.hi)}; }
+inline double4 sub(double4 a, double4 b) { return {vsubq_f64(a.lo, b.lo), vsubq_f64(a.hi, b.hi)}; }
+inline double4 mul(double4 a, double4 b) { return {vmulq_f64(a.lo, b.lo), vmulq_f64(a.hi, b.hi)}; }
+inline double4 div(double4 a, double4 b) { return {vdivq_f64(a.lo, b.lo), vdivq_f64(a.hi, b.hi)}; }
+inline double4 neg(double4 a) { return {vnegq_f64(a.lo), vnegq_f64(a.hi)}; }
+inline double4 sqrt(double4 a) { return {vsqrtq_f64(a.lo), vsqrtq_f64(a.hi)}; }
+inline double4 madd(double4 a, double4 b, double4 c) { return {vfmaq_f64(c.lo, a.lo, b.lo), vfmaq_f64(c.hi, a.hi, b.hi)}; }
+
+inline double4 hsum(double4 v) { return set1(vaddvq_f64(vaddq_f64(v.lo, v.hi))); }
+
+inline double first(double4 v) { return vgetq_lane_f64(v.lo, 0); }
+
+#endif
+
+} //namespace simd
+
+#endif // MATRIX_SIMD
+
+namespace simd {
+
+// IEEE 754 binary16: 1 sign, 5 exponent and 10 mantissa bits. Storage only;
+// convert to float for arithmetic.
+struct half {
+    std::uint16_t bits;
+};
+
+// Round to nearest even, like the hardware conversions
+inline half toHalf(float f) {
+#if defined(MATRIX_SIMD_SSE) && defined(__F16C__)
+    return half{(std::uint16_t)_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT)};
+#elif defined(MATRIX_SIMD_NEON)
+    const __fp16 h = (__fp16)f;
+    half r;
+    std::memcpy(&r.bits, &h, 2);
+    return r;
+#else
+    std::uint32_t x;
+    std::memcpy(&x, &f, 4);
+    const std::uint32_t sign = (x >> 16) & 0x8000u;
+    x &= 0x7fffffffu;
+    std::uint32_t bits;
+    if(x > 0x7f800000u) bits = 0x7e00u | ((x & 0x7fffffu) >> 13);     // NaN, quieted, payload kept
+    else if(x == 0x7f800000u) bits = 0x7c00u;                         // inf
+    else if(x >= 0x477ff000u) bits = 0x7c00u;                         // rounds past 65504
+    else if(x >= 0x38800000u) {                                       // normal
+        x -= 0x38000000u;                                             // rebias 127 -> 15
+        bits = (x + 0xfffu + ((x >> 13) & 1)) >> 13;
+    } else if(x >= 0x33000000u) {                                     // subnormal
+        const int shift = 126 - (int)(x >> 23);
+        const std::uint32_t m = (x & 0x7fffffu) | 0x800000u, rest = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        bits = m >> shift;
+        if(rest > halfway || (rest == halfway && (bits & 1))) ++bits;
+    } else bits = 0;
+    return half{(std::uint16_t)(sign | bits)};
+#endif
+}
+
+inline float toFloat(half h) {
+#if defined(MATRIX_SIMD_SSE) && defined(__F16C__)
+    return _cvtsh_ss(h.bits);
+#elif defined(MATRIX_SIMD_NEON)
+    __fp16 f;
+    std::memcpy(&f, &h.bits, 2);
+    return (float)f;
+#else
+    const std::uint32_t sign = (std::uint32_t)(h.bits & 0x8000u) << 16;
+    std::uint32_t exp = (h.bits >> 10) & 0x1fu, mant = h.bits & 0x3ffu, x;
+    if(exp == 0x1f) x = sign | 0x7f800000u | (mant ? 0x400000u | (mant << 13) : 0u); // inf, quiet NaN
+    else if(exp != 0) x = sign | ((exp + 112) << 23) | (mant << 13);
+    else if(mant == 0) x = sign;
+    else {                                                   // subnormal
+        exp = 113;
+        while(!(mant & 0x400u)) { mant <<= 1; --exp; }
+        x = sign | (exp << 23) | ((mant & 0x3ffu) << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, 4);
+    return f;
+#endif
+}
+
+// One T at a time; also handles the tails of the wide loops
+template<typename T>
+struct Scalar {
+    using type = T;
+    static constexpr int width = 1;
+    static type load(const T* p) { return *p; }
+    static type loadu(const T* p) { return *p; }
+    static void store(T* p, type v) { *p = v; }
+    static void storeu(T* p, type v) { *p = v; }
+    static type loadu(const half* p) { return type(toFloat(*p)); }
+    static void storeu(half* p, type v) { *p = toHalf(float(v)); }
+    static type set1(T s) { return s; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type madd(type a, type b, type c) { return a * b + c; }
+    // a with its sign flipped where b is negative
+    static type mulsign(type a, type b) { return std::signbit(b) ? -a : a; }
+    static type div(type a, type b) { return a / b; }
+    static type sqrt(type a) { return std::sqrt(a); }
+    // For the function approximations of fast_math.h
+    using mask = bool;
+    static mask less(type a, type b) { return a < b; }
+    static int bits(mask m) { return m; } // bit k set where lane k of m is
+    // a where m is set; on the bits, as m ? a : b compiles to branches that
+    // mispredict on unsorted input
+    static type select(mask m, type a, type b) {
+        using Bits = typename std::conditional<sizeof(T) == 8, std::uint64_t, std::uint32_t>::type;
+        Bits x, y;
+        std::memcpy(&x, &a, sizeof(T));
+        std::memcpy(&y, &b, sizeof(T));
+        const Bits all = Bits(0) - Bits(m);
+        x = (x & all) | (y & ~all);
+        std::memcpy(&a, &x, sizeof(T));
+        return a;
+    }
+    static type abs(type a) { return std::abs(a); }
+    static type min(type a, type b) { return a < b ? a : b; }
+    static type max(type a, type b) { return a < b ? b : a; }
+    static type round(type a) { return std::nearbyint(a); } // to nearest, ties to even
+    static type pow2(type n) { return std::ldexp(type(1), (int)n); } // integral n in [-126, 127]
+    // mantissa in [0.5, 1) and exponent of a positive normal a
+    static type frexp(type a, type& e) {
+        int i;
+        const type m = std::frexp(a, &i);
+        e = type(i);
+        return m;
+    }
+};
+
+template<typename T>
+struct Wide : Scalar<T> { };
+
+#if defined(MATRIX_SIMD_SSE) && defined(__AVX512F__)
+template<>
+struct Wide<float> {
+    using type = __m512;
+    static constexpr int width = 16;
+    static type load(const float* p) { return _mm512_load_ps(p); }
+    static type loadu(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, type v) { _mm512_store_ps(p, v); }
+    static void storeu(float* p, type v) { _mm512_storeu_ps(p, v); }
+    static type loadu(const half* p) { return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)p)); }
+    static void storeu(half* p, type v) { _mm256_storeu_si256((__m256i*)p, _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT)); }
+    static type set1(float s) { return _mm512_set1_ps(s); }
+    static type add(type a, type b) { return _mm512_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_ps(a, b); }
+    static type mulsign(type a, type b) { return _mm512_castsi512_ps(_mm512_xor_epi32(_mm512_castps_si512(a), _mm512_and_epi32(_mm512_castps_si512(b), _mm512_set1_epi32(INT32_MIN)))); }
+    static type mul(type a, type b) { return _mm512_mul_ps(a, b); }
+    static type madd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+    static type div(type a, type b) { return _mm512_div_ps(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_ps(a); }
+    using mask = __mmask16;
+    static mask less(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static int bits(mask m) { return m; }
+    static type select(mask m, type a, type b) { return _mm512_mask_blend_ps(m, b, a); }
+    static type abs(type a) { return _mm512_abs_ps(a); }
+    static type min(type a, type b) { return _mm512_min_ps(a, b); }
+    static type max(type a, type b) { return _mm512_max_ps(a, b); }
+    static type round(type a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type pow2(type n) { return _mm512_scalef_ps(_mm512_set1_ps(1.0f), n); }
+    static type frexp(type a, type& e) {
+        e = _mm512_add_ps(_mm512_getexp_ps(a), _mm512_set1_ps(1.0f));
+        return _mm512_getmant_ps(a, _MM_MANT_NORM_p5_1, _MM_MANT_SIGN_src);
+    }
+};
+
+template<>
+struct Wide<double> {
+    using type = __m512d;
+    static constexpr int width = 8;
+    static type load(const double* p) { return _mm512_load_pd(p); }
+    static type loadu(const double* p) { return _mm512_loadu_pd(p); }
+    static void store(double* p, type v) { _mm512_store_pd(p, v); }
+    static void storeu(double* p, type v) { _mm512_storeu_pd(p, v); }
+    static type set1(double s) { return _mm512_set1_pd(s); }
+    static type add(type a, type b) { return _mm512_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+    static type mulsign(type a, type b) { return _mm512_castsi512_pd(_mm512_xor_epi64(_mm512_castpd_si512(a), _mm512_and_epi64(_mm512_castpd_si512(b), _mm512_set1_epi64(INT64_MIN)))); }
+    static type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+    static type madd(type a, type b, type c) { return _mm512_fmadd_pd(a, b, c); }
+    static type div(type a, type b) { return _mm512_div_pd(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_pd(a); }
+};
+#elif defined(MATRIX_SIMD_SSE) && defined(__AVX__)
+template<>
+struct Wide<float> {
+    using type = __m256;
+    static constexpr int width = 8;
+    static type load(const float* p) { return _mm256_load_ps(p); }
+    static type loadu(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, type v) { _mm256_store_ps(p, v); }
+    static void storeu(float* p, type v) { _mm256_storeu_ps(p, v); }
+#ifdef __F16C__
+    static type loadu(const half* p) { return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p)); }
+    static void storeu(half* p, type v) { _mm_storeu_si128((__m128i*)p, _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT)); }
+#else
+    static type loadu(const half* p) {
+        alignas(32) float f[8];
+        for(int i = 0; i < 8; ++i) f[i] = toFloat(p[i]);
+        return _mm256_load_ps(f);
+    }
+    static void storeu(half* p, type v) {
+        alignas(32) float f[8];
+        _mm256_store_ps(f, v);
+        for(int i = 0; i < 8; ++i) p[i] = toHalf(f[i]);
+    }
+#endif
+    static type set1(float s) { return _mm256_set1_ps(s); }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mulsign(type a, type b) { return _mm256_xor_ps(a, _mm256_and_ps(b, _mm256_set1_ps(-0.0f))); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+#ifdef __FMA__
+    static type madd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+    static type madd(type a, type b, type c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+    static type div(type a, type b) { return _mm256_div_ps(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+    using mask = __m256;
+    static mask less(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static int bits(mask m) { return _mm256_movemask_ps(m); }
+    static type select(mask m, type a, type b) { return _mm256_blendv_ps(b, a, m); }
+    static type abs(type a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static type min(type a, type b) { return _mm256_min_ps(a, b); }
+    static type max(type a, type b) { return _mm256_max_ps(a, b); }
+    static type round(type a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    // the exponent field is set with integer ops: 256-bit ones need AVX2,
+    // otherwise each 128-bit half goes through SSE2
+#ifdef __AVX2__
+    static type pow2(type n) {
+        const __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+    }
+    static type frexp(type a, type& e) {
+        const __m256i bits = _mm256_castps_si256(a);
+        e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+        return _mm256_or_ps(_mm256_and_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(0x807fffff))), _mm256_set1_ps(0.5f));
+    }
+#else
+    static type pow2(type n) {
+        const __m256i e = _mm256_cvtps_epi32(n);
+        const __m128i bias = _mm_set1_epi32(127);
+        const __m128i lo = _mm_slli_epi32(_mm_add_epi32(_mm256_castsi256_si128(e), bias), 23);
+        const __m128i hi = _mm_slli_epi32(_mm_add_epi32(_mm256_extractf128_si256(e, 1), bias), 23);
+        return _mm256_castsi256_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+    }
+    static type frexp(type a, type& e) {
+        const __m256i bits = _mm256_castps_si256(a);
+        const __m128i bias = _mm_set1_epi32(126);
+        const __m128i lo = _mm_sub_epi32(_mm_srli_epi32(_mm256_castsi256_si128(bits), 23), bias);
+        const __m128i hi = _mm_sub_epi32(_mm_srli_epi32(_mm256_extractf128_si256(bits, 1), 23), bias);
+        e = _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+        return _mm256_or_ps(_mm256_and_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(0x807fffff))), _mm256_set1_ps(0.5f));
+    }
+#endif
+};
+
+template<>
+struct Wide<double> {
+    using type = __m256d;
+    static constexpr int width = 4;
+    static type load(const double* p) { return _mm256_load_pd(p); }
+    static type loadu(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, type v) { _mm256_store_pd(p, v); }
+    static void storeu(double* p, type v) { _mm256_storeu_pd(p, v); }
+    static type set1(double s) { return _mm256_set1_pd(s); }
+    static type add(type a, type b) { return _mm256_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+    static type mulsign(type a, type b) { return _mm256_xor_pd(a, _mm256_and_pd(b, _mm256_set1_pd(-0.0))); }
+    static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+#ifdef __FMA__
+    static type madd(type a, type b, type c) { return _mm256_fmadd_pd(a, b, c); }
+#else
+    static type madd(type a, type b, type c) { return _mm256_add_pd(_mm256_mul_pd(a, b), c); }
+#endif
+    static type div(type a, type b) { return _mm256_div_pd(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_pd(a); }
+};
+#elif defined(MATRIX_SIMD_SSE)
+template<>
+struct Wide<float> {
+    using type = float4;
+    static constexpr int width = 4;
+    static type load(const float* p) { return _mm_load_ps(p); }
+    static type loadu(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, type v) { _mm_store_ps(p, v); }
+    static void storeu(float* p, type v) { _mm_storeu_ps(p, v); }
+    static type loadu(const half* p) {
+        alignas(16) float f[4];
+        for(int i = 0; i < 4; ++i) f[i] = toFloat(p[i]);
+        return _mm_load_ps(f);
+    }
+    static void storeu(half* p, type v) {
+        alignas(16) float f[4];
+        _mm_store_ps(f, v);
+        for(int i = 0; i < 4; ++i) p[i] = toHalf(f[i]);
+    }
+    static type set1(float s) { return _mm_set1_ps(s); }
+    static type add(type a, type b) { return _mm_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static type mulsign(type a, type b) { return _mm_xor_ps(a, _mm_and_ps(b, _mm_set1_ps(-0.0f))); }
+    static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+    static type madd(type a, type b, type c) { return simd::madd(a, b, c); }
+    static type div(type a, type b) { return _mm_div_ps(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_ps(a); }
+    using mask = __m128;
+    static mask less(type a, type b) { return _mm_cmplt_ps(a, b); }
+    static int bits(mask m) { return _mm_movemask_ps(m); }
+#ifdef __SSE4_1__
+    static type select(mask m, type a, type b) { return _mm_blendv_ps(b, a, m); }
+    static type round(type a) { return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+#else
+    static type select(mask m, type a, type b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    // adding and removing 1.5 * 2^23 rounds away the fraction, for |a| < 2^22
+    static type round(type a) {
+        const type magic = _mm_set1_ps(12582912.0f);
+        return _mm_sub_ps(_mm_add_ps(a, magic), magic);
+    }
+#endif
+    static type abs(type a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static type min(type a, type b) { return _mm_min_ps(a, b); }
+    static type max(type a, type b) { return _mm_max_ps(a, b); }
+    static type pow2(type n) {
+        return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23));
+    }
+    static type frexp(type a, type& e) {
+        e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(a), 23), _mm_set1_epi32(126)));
+        return _mm_or_ps(_mm_and_ps(a, _mm_castsi128_ps(_mm_set1_epi32(0x807fffff))), _mm_set1_ps(0.5f));
+    }
+};
+
+template<>
+struct Wide<double> {
+    using type = __m128d;
+    static constexpr int width = 2;
+    static type load(const double* p) { return _mm_load_pd(p); }
+    static type loadu(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, type v) { _mm_store_pd(p, v); }
+    static void storeu(double* p, type v) { _mm_storeu_pd(p, v); }
+    static type set1(double s) { return _mm_set1_pd(s); }
+    static type add(type a, type b) { return _mm_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm_sub_pd(a, b); }
+    static type mulsign(type a, type b) { return _mm_xor_pd(a, _mm_and_pd(b, _mm_set1_pd(-0.0))); }
+    static type mul(type a, type b) { return _mm_mul_pd(a, b); }
+    static type madd(type a, type b, type c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static type div(type a, type b) { return _mm_div_pd(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_pd(a); }
+};
+#elif defined(MATRIX_SIMD_NEON)
+template<>
+struct Wide<float> {
+    using type = float32x4_t;
+    static constexpr int width = 4;
+    static type load(const float* p) { return vld1q_f32(p); }
+    static type loadu(const float* p) { return vld1q_f32(p); }
+    static void store(float* p, type v) { vst1q_f32(p, v); }
+    static void storeu(float* p, type v) { vst1q_f32(p, v); }
+    static type loadu(const half* p) { return vcvt_f32_f16(vld1_f16((const __fp16*)p)); }
+    static void storeu(half* p, type v) { vst1_f16((__fp16*)p, vcvt_f16_f32(v)); }
+    static type set1(float s) { return vdupq_n_f32(s); }
+    static type add(type a, type b) { return vaddq_f32(a, b); }
+    static type sub(type a, type b) { return vsubq_f32(a, b); }
+    static type mulsign(type a, type b) { return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), vandq_u32(vreinterpretq_u32_f32(b), vdupq_n_u32(0x80000000u)))); }
+    static type mul(type a, type b) { return vmulq_f32(a, b); }
+    static type madd(type a, type b, type c) { return vfmaq_f32(c, a, b); }
+    static type div(type a, type b) { return vdivq_f32(a, b); }
+    static type sqrt(type a) { return vsqrtq_f32(a); }
+    using mask = uint32x4_t;
+    static mask less(type a, type b) { return vcltq_f32(a, b); }
+    static int bits(mask m) {
+        const uint32_t weights[4] = {1, 2, 4, 8};
+        return (int)vaddvq_u32(vandq_u32(m, vld1q_u32(weights)));
+    }
+    static type select(mask m, type a, type b) { return vbslq_f32(m, a, b); }
+    static type abs(type a) { return vabsq_f32(a); }
+    static type min(type a, type b) { return vminq_f32(a, b); }
+    static type max(type a, type b) { return vmaxq_f32(a, b); }
+    static type round(type a) { return vrndnq_f32(a); }
+    static type pow2(type n) {
+        return vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(vcvtnq_s32_f32(n), vdupq_n_s32(127)), 23));
+    }
+    static type frexp(type a, type& e) {
+        const uint32x4_t bits = vreinterpretq_u32_f32(a);
+        e = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(126)));
+        return vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x807fffffu)), vdupq_n_u32(0x3f000000u)));
+    }
+};
+
+template<>
+struct Wide<double> {
+    using type = float64x2_t;
+    static constexpr int width = 2;
+    static type load(const double* p) { return vld1q_f64(p); }
+    static type loadu(const double* p) { return vld1q_f64(p); }
+    static void store(double* p, type v) { vst1q_f64(p, v); }
+    static void storeu(double* p, type v) { vst1q_f64(p, v); }
+    static type set1(double s) { return vdupq_n_f64(s); }
+    static type add(type a, type b) { return vaddq_f64(a, b); }
+    static type sub(type a, type b) { return vsubq_f64(a, b); }
+    static type mulsign(type a, type b) { return vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(a), vandq_u64(vreinterpretq_u64_f64(b), vdupq_n_u64(0x8000000000000000u)))); }
+    static type mul(type a, type b) { return vmulq_f64(a, b); }
+    static type madd(type a, type b, type c) { return vfmaq_f64(c, a, b); }
+    static type div(type a, type b) { return vdivq_f64(a, b); }
+    static type sqrt(type a) { return vsqrtq_f64(a); }
+};
+#endif
+
+// count values from half to float and back, a vector at a time
+inline void toFloat(const half* in, float* out, std::size_t count) {
+    using Ops = Wide<float>;
+    const std::size_t bulk = count - count % Ops::width;
+    std::size_t i = 0;
+    for(; i < bulk; i += Ops::width) Ops::storeu(out + i, Ops::loadu(in + i));
+    for(; i < count; ++i) out[i] = toFloat(in[i]);
+}
+
+inline void toHalf(const float* in, half* out, std::size_t count) {
+    using Ops = Wide<float>;
+    const std::size_t bulk = count - count % Ops::width;
+    std::size_t i = 0;
+    for(; i < bulk; i += Ops::width) Ops::storeu(out + i, Ops::loadu(in + i));
+    for(; i < count; ++i) out[i] = toHalf(in[i]);
+}
+
+} //namespace simd
+
+// Allocator whose blocks start on an 'alignment' byte boundary, so SIMD
+// streams never straddle cache lines at their start.
+template<typename T, std::size_t alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+    template<typename U> struct rebind { using other = AlignedAllocator<U, alignment>; };
+
+    AlignedAllocator() = default;
+    template<typename U> AlignedAllocator(const AlignedAllocator<U, alignment>&) { }
+
+    T* allocate(std::size_t n) {
+        // the original pointer is kept just before the aligned block
+        char* raw = static_cast<char*>(::operator new(n * sizeof(T) + alignment + sizeof(void*)));
+        std::uintptr_t aligned = ((std::uintptr_t)(raw + sizeof(void*)) + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+        ((void**)aligned)[-1] = raw;
+        return (T*)aligned;
+    }
+
+    void deallocate(T* p, std::size_t) { ::operator delete(((void**)p)[-1]); }
+};
+
+template<typename T, typename U, std::size_t a>
+bool operator==(const AlignedAllocator<T, a>&, const AlignedAllocator<U, a>&) { return true; }
+template<typename T, typename U, std::size_t a>
+bool operator!=(const AlignedAllocator<T, a>&, const AlignedAllocator<U, a>&) { return false; }
+
+#endif // SIMD_H
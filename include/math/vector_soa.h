@@ -0,0 +1,280 @@
+#ifndef VECTOR_SOA_H
+#define VECTOR_SOA_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "matrix.h"
+
+namespace soa_detail {
+
+// The type a stored component is read and written as: simd::half components
+// are exchanged as float
+template<typename T>
+struct Element {
+    using value = T;
+    static T get(T x) { return x; }
+    static T put(T x) { return x; }
+};
+
+template<>
+struct Element<simd::half> {
+    using value = float;
+    static float get(simd::half x) { return simd::toFloat(x); }
+    static simd::half put(float x) { return simd::toHalf(x); }
+};
+
+} //namespace soa_detail
+
+// Structure-of-arrays storage for n-component vectors: component k of point
+// i is data[k][i]. Every component is its own contiguous, 64-byte aligned
+// stream, so the batch kernels below load 4-16 points per instruction.
+// With T = simd::half the points take half the memory of float ones and are
+// converted to float in registers by the batch functions.
+template <int n, typename T = float>
+struct VectorSoA {
+    using value_type = typename soa_detail::Element<T>::value;
+
+    std::vector<T, AlignedAllocator<T>> data[n];
+
+    VectorSoA() = default;
+    explicit VectorSoA(std::size_t count) { resize(count); }
+    VectorSoA(const Vector<n, value_type>* points, std::size_t count) { assign(points, count); }
+
+    std::size_t size() const { return data[0].size(); }
+    void resize(std::size_t count) { for(auto& c : data) c.resize(count); }
+    void reserve(std::size_t count) { for(auto& c : data) c.reserve(count); }
+
+    T* operator[](int k) { return data[k].data(); }
+    const T* operator[](int k) const { return data[k].data(); }
+
+    Vector<n, value_type> get(std::size_t i) const {
+        Vector<n, value_type> v;
+        for(int k = 0; k < n; ++k) v.data[k] = soa_detail::Element<T>::get(data[k][i]);
+        return v;
+    }
+
+    void set(std::size_t i, const Vector<n, value_type>& v) {
+        for(int k = 0; k < n; ++k) data[k][i] = soa_detail::Element<T>::put(v.data[k]);
+    }
+    void push_back(const Vector<n, value_type>& v) {
+        for(int k = 0; k < n; ++k) data[k].push_back(soa_detail::Element<T>::put(v.data[k]));
+    }
+
+    // Conversion from and to array-of-structs
+    void assign(const Vector<n, value_type>* points, std::size_t count) {
+        resize(count);
+        for(std::size_t i = 0; i < count; ++i) set(i, points[i]);
+    }
+
+    void extract(Vector<n, value_type>* points) const {
+        for(std::size_t i = 0; i < size(); ++i) points[i] = get(i);
+    }
+};
+
+using Points3f = VectorSoA<3>;
+using Points4f = VectorSoA<4>;
+using Points3h = VectorSoA<3, simd::half>;
+using Points4h = VectorSoA<4, simd::half>;
+
+namespace soa_detail {
+
+// Arrays below this many points per thread are not split
+constexpr std::size_t min_grain = 1 << 16;
+
+// Calls func(begin, end) on contiguous ranges of [0, count) on up to
+// 'threads' threads (0 = one per core). Range boundaries are multiples of 64
+// points so every thread starts on a cache line.
+template<typename Func>
+void parallelRanges(std::size_t count, unsigned threads, const Func& func) {
+    if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = (unsigned)std::min<std::size_t>(threads, std::max<std::size_t>(count / min_grain, 1));
+    if(threads <= 1) {
+        func(std::size_t(0), count);
+        return;
+    }
+
+    const std::size_t step = ((count + threads - 1) / threads + 63) & ~std::size_t(63);
+    std::vector<std::thread> pool;
+    for(std::size_t begin = step; begin < count; begin += step)
+        pool.emplace_back(func, begin, std::min(count, begin + step));
+    func(std::size_t(0), std::min(count, step));
+    for(auto& t : pool) t.join();
+}
+
+// The kernels run with simd::Wide<float> for the bulk of a range and with
+// simd::Scalar<float> for the tail. Their input and output streams are float
+// or simd::half; half is converted on load and store, all arithmetic is float.
+using WideOps = simd::Wide<float>;
+using ScalarOps = simd::Scalar<float>;
+
+// Every kernel handles the points [i, end) in steps of Ops::width as long as
+// a whole step fits and returns the first unprocessed index. All inputs of a
+// point are loaded before its outputs are stored, so in-place use is safe.
+
+// out = m * (in, w) for 'inputs' components in, 'outputs' components out;
+// a missing fourth input component is taken as 1 (a point)
+template<typename Ops, int inputs, int outputs, typename In, typename Out>
+std::size_t transformKernel(const Matrix4f& m, const In* const* in, Out* const* out,
+                            std::size_t i, std::size_t end) {
+    using V = typename Ops::type;
+    V col[4][4];
+    for(int c = 0; c < 4; ++c)
+        for(int r = 0; r < 4; ++r) col[c][r] = Ops::set1(m.data[r + 4*c]);
+
+    for(; i + Ops::width <= end; i += Ops::width) {
+        V v[4];
+        for(int c = 0; c < inputs; ++c) v[c] = Ops::loadu(in[c] + i);
+
+        for(int r = 0; r < outputs; ++r) {
+            V acc = inputs == 4 ? Ops::mul(col[3][r], v[3]) : col[3][r];
+            for(int c = 0; c < 3; ++c) acc = Ops::madd(col[c][r], v[c], acc);
+            Ops::storeu(out[r] + i, acc);
+        }
+    }
+    return i;
+}
+
+template<typename Ops, int n, typename In>
+std::size_t dotKernel(const In* const* a, const In* const* b, float* out, std::size_t i, std::size_t end) {
+    using V = typename Ops::type;
+    for(; i + Ops::width <= end; i += Ops::width) {
+        V acc = Ops::mul(Ops::loadu(a[0] + i), Ops::loadu(b[0] + i));
+        for(int k = 1; k < n; ++k) acc = Ops::madd(Ops::loadu(a[k] + i), Ops::loadu(b[k] + i), acc);
+        Ops::storeu(out + i, acc);
+    }
+    return i;
+}
+
+template<typename Ops, int n, typename In>
+std::size_t lengthKernel(const In* const* a, float* out, std::size_t i, std::size_t end) {
+    using V = typename Ops::type;
+    for(; i + Ops::width <= end; i += Ops::width) {
+        V acc = Ops::mul(Ops::loadu(a[0] + i), Ops::loadu(a[0] + i));
+        for(int k = 1; k < n; ++k) acc = Ops::madd(Ops::loadu(a[k] + i), Ops::loadu(a[k] + i), acc);
+        Ops::storeu(out + i, Ops::sqrt(acc));
+    }
+    return i;
+}
+
+template<typename Ops, int n, typename In, typename Out>
+std::size_t normalizeKernel(const In* const* in, Out* const* out, std::size_t i, std::size_t end) {
+    using V = typename Ops::type;
+    for(; i + Ops::width <= end; i += Ops::width) {
+        V v[n];
+        V acc = Ops::set1(0.0f);
+        for(int k = 0; k < n; ++k) {
+            v[k] = Ops::loadu(in[k] + i);
+            acc = Ops::madd(v[k], v[k], acc);
+        }
+        const V len = Ops::sqrt(acc);
+        for(int k = 0; k < n; ++k) Ops::storeu(out[k] + i, Ops::div(v[k], len));
+    }
+    return i;
+}
+
+template<int n, typename T>
+void pointers(const VectorSoA<n, T>& soa, const T* (&p)[n]) { for(int k = 0; k < n; ++k) p[k] = soa[k]; }
+
+template<int n, typename T>
+void pointers(VectorSoA<n, T>& soa, T* (&p)[n]) { for(int k = 0; k < n; ++k) p[k] = soa[k]; }
+
+template<int inputs, int outputs, typename In, typename Out>
+void transform(const Matrix4f& m, const VectorSoA<inputs, In>& in, VectorSoA<outputs, Out>& out, unsigned threads) {
+    out.resize(in.size());
+    const In* src[inputs];
+    Out* dst[outputs];
+    pointers(in, src);
+    pointers(out, dst);
+    parallelRanges(in.size(), threads, [&](std::size_t begin, std::size_t end) {
+        begin = transformKernel<WideOps, inputs, outputs>(m, src, dst, begin, end);
+        transformKernel<ScalarOps, inputs, outputs>(m, src, dst, begin, end);
+    });
+}
+
+} //namespace soa_detail
+
+///////////// Batch functions on VectorSoA /////////////
+// 'threads' splits very large arrays over that many threads (0 = one per
+// core); arrays of less than soa_detail::min_grain points per thread stay on
+// the calling thread. The outputs may alias the inputs.
+
+// The component types T, In and Out are float or simd::half.
+
+// out[i] = (m * (in[i], 1)).xyz -- affine transform of 3D points
+template<typename In, typename Out>
+void transform_points(const Matrix4f& m, const VectorSoA<3, In>& in, VectorSoA<3, Out>& out, unsigned threads = 1) {
+    soa_detail::transform<3, 3>(m, in, out, threads);
+}
+
+// out[i] = m * in[i]
+template<typename In, typename Out>
+void transform_points(const Matrix4f& m, const VectorSoA<4, In>& in, VectorSoA<4, Out>& out, unsigned threads = 1) {
+    soa_detail::transform<4, 4>(m, in, out, threads);
+}
+
+// out[i] = m_dot(a[i], b[i]); 'out' holds a.size() values
+template<int n, typename T>
+void batch_dot(const VectorSoA<n, T>& a, const VectorSoA<n, T>& b, float* out, unsigned threads = 1) {
+    namespace sd = soa_detail;
+    const T* pa[n];
+    const T* pb[n];
+    sd::pointers(a, pa);
+    sd::pointers(b, pb);
+    sd::parallelRanges(a.size(), threads, [&](std::size_t begin, std::size_t end) {
+        begin = sd::dotKernel<sd::WideOps, n>(pa, pb, out, begin, end);
+        sd::dotKernel<sd::ScalarOps, n>(pa, pb, out, begin, end);
+    });
+}
+
+// out[i] = m_length(a[i]); 'out' holds a.size() values
+template<int n, typename T>
+void batch_length(const VectorSoA<n, T>& a, float* out, unsigned threads = 1) {
+    namespace sd = soa_detail;
+    const T* pa[n];
+    sd::pointers(a, pa);
+    sd::parallelRanges(a.size(), threads, [&](std::size_t begin, std::size_t end) {
+        begin = sd::lengthKernel<sd::WideOps, n>(pa, out, begin, end);
+        sd::lengthKernel<sd::ScalarOps, n>(pa, out, begin, end);
+    });
+}
+
+// out[i] = m_normalize(in[i])
+template<int n, typename In, typename Out>
+void batch_normalize(const VectorSoA<n, In>& in, VectorSoA<n, Out>& out, unsigned threads = 1) {
+    namespace sd = soa_detail;
+    out.resize(in.size());
+    const In* src[n];
+    Out* dst[n];
+    sd::pointers(in, src);
+    sd::pointers(out, dst);
+    sd::parallelRanges(in.size(), threads, [&](std::size_t begin, std::size_t end) {
+        begin = sd::normalizeKernel<sd::WideOps, n>(src, dst, begin, end);
+        sd::normalizeKernel<sd::ScalarOps, n>(src, dst, begin, end);
+    });
+}
+
+namespace soa_detail {
+
+template<typename T>
+void convert(const T* in, T* out, std::size_t count) { std::copy(in, in + count, out); }
+inline void convert(const simd::half* in, float* out, std::size_t count) { simd::toFloat(in, out, count); }
+inline void convert(const float* in, simd::half* out, std::size_t count) { simd::toHalf(in, out, count); }
+
+} //namespace soa_detail
+
+// out[i] = in[i] in out's component type, e.g. Points3f to Points3h to store
+// a batch at half the size
+template<int n, typename In, typename Out>
+void batch_convert(const VectorSoA<n, In>& in, VectorSoA<n, Out>& out, unsigned threads = 1) {
+    namespace sd = soa_detail;
+    out.resize(in.size());
+    sd::parallelRanges(in.size(), threads, [&](std::size_t begin, std::size_t end) {
+        for(int k = 0; k < n; ++k) sd::convert(in[k] + begin, out[k] + begin, end - begin);
+    });
+}
+
+#endif // VECTOR_SOA_H
@@ -2,18 +2,242 @@
 #define MONTE_CARLO_H
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <functional>
 #include <numeric>
 #include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "sampling.h"
+#include "simd_rng.h"
+
+// Result of a convergence-driven simulation
+template<typename D>
+struct MonteCarloEstimate {
+    D estimate;          // mean of the samples
+    D std_error;         // standard error of the mean
+    std::size_t samples; // number of samples drawn
+};
+
 template<typename D>
 using reduction_func_t = std::function<D(const D&, const D&)>;
 
 template<typename D, typename R>
 using sample_func_t = std::function<D(const std::function<R()>&)>;
 
-template<typename DataType, typename RNGType = DataType>
+namespace monte_carlo_detail {
+
+// Parallel runs are cut into blocks of this many samples. Each block has its
+// own generator seeded from child 'block' of SeedSequence(seed), so the result
+// of a seeded run only depends on the seed and the sample count, never on the
+// thread count.
+constexpr std::size_t block_size = 1 << 20;
+
+// Samples are produced into a buffer of this many values before being folded
+// into the running reduction, so memory use is constant in the sample count.
+constexpr std::size_t chunk_size = 256;
+
+inline std::size_t blockCount(std::size_t sample_count) {
+    return (sample_count + block_size - 1) / block_size;
+}
+
+inline unsigned threadCount(unsigned requested, std::size_t blocks) {
+    unsigned threads = requested ? requested : std::thread::hardware_concurrency();
+    if(threads == 0) threads = 1;
+    return (unsigned)std::min<std::size_t>(threads, std::max<std::size_t>(blocks, 1));
+}
+
+// Generator for one block of a parallel run
+template<typename Engine>
+Engine blockEngine(std::uint64_t seed, std::size_t block) {
+    SeedSequence seq = SeedSequence(seed).child(block);
+    return Engine(seq);
+}
+
+// Folds 'count' samples from sampleFunc() into a running reduction. The samples
+// go through a chunk buffer and are never stored as a whole.
+template<typename D, typename SampleFunc, typename Reducer>
+D reduceChunked(std::size_t count, SampleFunc&& sampleFunc, Reducer&& reducer) {
+    std::array<D, chunk_size> chunk;
+    D acc = static_cast<D>(0);
+    while(count) {
+        const std::size_t n = std::min(count, chunk.size());
+        for(std::size_t i = 0; i < n; ++i)
+            chunk[i] = sampleFunc();
+        acc = std::accumulate(chunk.begin(), chunk.begin() + n, acc, reducer);
+        count -= n;
+    }
+    return acc;
+}
+
+// Running mean and variance (Welford). Whole chunks are merged at once with
+// the pairwise update of Chan et al. so the per-sample work stays a plain sum.
+template<typename D>
+struct RunningStats {
+    std::size_t count = 0;
+    D mean = static_cast<D>(0);
+    D m2 = static_cast<D>(0);
+
+    template<typename Iterator>
+    void addChunk(Iterator begin, Iterator end) {
+        const std::size_t n = std::distance(begin, end);
+        if(n == 0) return;
+
+        const D chunk_mean = std::accumulate(begin, end, static_cast<D>(0)) / n;
+        D chunk_m2 = static_cast<D>(0);
+        for(Iterator it = begin; it != end; ++it) chunk_m2 += (*it - chunk_mean) * (*it - chunk_mean);
+
+        const std::size_t total = count + n;
+        const D delta = chunk_mean - mean;
+        mean += delta * n / total;
+        m2 += chunk_m2 + delta * delta * ((D)count * n / total);
+        count = total;
+    }
+
+    D variance() const { return count > 1 ? m2 / (count - 1) : static_cast<D>(0); }
+    D stdError() const { return count ? std::sqrt(variance() / count) : std::numeric_limits<D>::infinity(); }
+};
+
+// Draws samples in chunks until the standard error of the mean is at most
+// 'tolerance' (after at least 'min_samples'), 'max_samples' were drawn or
+// 'time_budget' ran out, whichever comes first.
+template<typename D, typename SampleFunc>
+MonteCarloEstimate<D> simulateUntil(SampleFunc&& sampleFunc, D tolerance,
+                                    std::chrono::duration<double> time_budget,
+                                    std::size_t max_samples, std::size_t min_samples) {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::array<D, chunk_size> chunk;
+    RunningStats<D> stats;
+    while(stats.count < max_samples) {
+        const std::size_t n = std::min(max_samples - stats.count, chunk.size());
+        for(std::size_t i = 0; i < n; ++i)
+            chunk[i] = sampleFunc();
+        stats.addChunk(chunk.begin(), chunk.begin() + n);
+
+        if(stats.count >= min_samples && stats.stdError() <= tolerance) break;
+        if(std::chrono::steady_clock::now() - start >= time_budget) break;
+    }
+    return {stats.mean, stats.stdError(), stats.count};
+}
+
+// Next uniform value of the current sample, mapped to the range of 'dist'
+template<typename R, typename Engine>
+R drawUniform(Engine& engine, std::uniform_real_distribution<R>& dist, SampleSequence& sequence) {
+    if(sequence.sampling() == Sampling::Uniform) return dist(engine);
+    return dist.a() + (dist.b() - dist.a()) * (R)sequence.next(engine);
+}
+
+// Calls blockFunc(block, first_sample, block_samples) for the blocks
+// [first_block, end_block) on 'threads' workers and returns their results in
+// block order.
+template<typename D, typename BlockFunc>
+std::vector<D> runBlocks(std::size_t sample_count, std::size_t first_block, std::size_t end_block,
+                         unsigned threads, const BlockFunc& blockFunc) {
+    std::vector<D> results(end_block - first_block);
+    std::atomic<std::size_t> next_block(first_block);
+
+    auto worker = [&] {
+        for(std::size_t b = next_block++; b < end_block; b = next_block++) {
+            std::size_t first = b * block_size;
+            results[b - first_block] = blockFunc(b, first, std::min(block_size, sample_count - first));
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for(auto& t : pool) t.join();
+
+    return results;
+}
+
+} //namespace monte_carlo_detail
+
+// Progress of a resumable parallel run: the run's parameters and the
+// reduction of its first 'blocks_done' blocks. Between two resume() calls it
+// can be serialized, so a long simulation survives a restart of the process.
+template<typename D>
+struct MonteCarloCheckpoint {
+    std::uint64_t seed = 0;
+    std::uint64_t sample_count = 0;
+    std::uint64_t blocks_done = 0;
+    Sampling sampling = Sampling::Uniform;
+    D partial = static_cast<D>(0);
+
+    bool done() const { return blocks_done >= monte_carlo_detail::blockCount(sample_count); }
+    D result() const { return partial / sample_count; }
+
+    // Binary form for the same build; D must be trivially copyable
+    std::string serialize() const {
+        std::string out;
+        rng_detail::putBytes(out, magic);
+        rng_detail::putBytes(out, seed);
+        rng_detail::putBytes(out, sample_count);
+        rng_detail::putBytes(out, blocks_done);
+        rng_detail::putBytes(out, sampling);
+        rng_detail::putBytes(out, partial);
+        return out;
+    }
+
+    // Returns false and leaves the checkpoint unchanged if 'data' is not the
+    // output of serialize()
+    bool deserialize(const std::string& data) {
+        MonteCarloCheckpoint c;
+        std::size_t pos = 0;
+        std::uint32_t m = 0;
+        if(!rng_detail::getBytes(data, pos, m) || m != magic ||
+           !rng_detail::getBytes(data, pos, c.seed) || !rng_detail::getBytes(data, pos, c.sample_count) ||
+           !rng_detail::getBytes(data, pos, c.blocks_done) || !rng_detail::getBytes(data, pos, c.sampling) ||
+           !rng_detail::getBytes(data, pos, c.partial) || pos != data.size())
+            return false;
+        *this = c;
+        return true;
+    }
+
+private:
+    static constexpr std::uint32_t magic = 0x3143434d; // "MCC1"
+};
+
+template<typename D>
+constexpr std::uint32_t MonteCarloCheckpoint<D>::magic;
+
+namespace monte_carlo_detail {
+
+// Runs up to 'max_blocks' further blocks of 'checkpoint' and folds their
+// results into it in block order. Returns true once the run is complete.
+template<typename D, typename BlockFunc, typename Reducer>
+bool resume(MonteCarloCheckpoint<D>& checkpoint, unsigned thread_count, std::size_t max_blocks,
+            const BlockFunc& blockFunc, Reducer& reducer) {
+    const std::size_t blocks = blockCount(checkpoint.sample_count);
+    if(checkpoint.blocks_done >= blocks) return true;
+
+    const std::size_t first = checkpoint.blocks_done;
+    const std::size_t end = first + std::min<std::size_t>(max_blocks, blocks - first);
+    std::vector<D> partials = runBlocks<D>(checkpoint.sample_count, first, end,
+                                           threadCount(thread_count, end - first), blockFunc);
+    checkpoint.partial = std::accumulate(partials.begin(), partials.end(), checkpoint.partial, reducer);
+    checkpoint.blocks_done = end;
+    return checkpoint.done();
+}
+
+inline std::uint64_t randomSeed() {
+    std::random_device rd;
+    return ((std::uint64_t)rd() << 32) | rd();
+}
+
+} //namespace monte_carlo_detail
+
+template<typename DataType, typename RNGType = DataType, typename Engine = std::mt19937>
 class MonteCarlo {
 public:
     explicit MonteCarlo(
@@ -23,30 +247,349 @@ public:
     {
     }
 
+    // Seeded: every simulate and simulateUntil sequence is reproducible
+    MonteCarlo(
+    const sample_func_t<DataType, RNGType>& samplingFunc,
+    const reduction_func_t<DataType>& reductionFunc,
+    std::uint64_t seed)
+    : MonteCarlo(samplingFunc, reductionFunc)
+    {
+        setSeed(seed);
+    }
+
     DataType simulate(const std::size_t& sample_count) {
-        auto rngFunc = [this] () { return dist(rng); };
+        DataType result = reduceSamples(rng, dist, sequence, sampleIndex, sample_count) / sample_count;
+        sampleIndex += sample_count;
+        return result;
+    }
+
+    // Splits the samples across 'thread_count' workers (0 = one per core).
+    // Every block of samples is drawn from its own generator and the block
+    // results are combined in block order with the reduction function.
+    // The sampling and reduction functions are called concurrently.
+    DataType simulate(const std::size_t& sample_count, unsigned thread_count) {
+        MonteCarloCheckpoint<DataType> checkpoint = beginRun(sample_count);
+        resume(checkpoint, thread_count);
+        return checkpoint.result();
+    }
+
+    // Starts a resumable parallel run of 'sample_count' samples with the
+    // current seed and sampling strategy. Nothing is drawn until resume().
+    MonteCarloCheckpoint<DataType> beginRun(std::size_t sample_count) {
+        MonteCarloCheckpoint<DataType> checkpoint;
+        checkpoint.seed = hasSeed ? seed : ((std::uint64_t)rd() << 32 | rd());
+        checkpoint.sample_count = sample_count;
+        checkpoint.sampling = sampling;
+        return checkpoint;
+    }
+
+    // Runs up to 'max_blocks' more blocks (of monte_carlo_detail::block_size
+    // samples) of 'checkpoint' on 'thread_count' workers. Returns true when
+    // the run is complete; checkpoint.result() is then the same as the
+    // parallel simulate with the checkpoint's seed, however the run was split.
+    bool resume(MonteCarloCheckpoint<DataType>& checkpoint, unsigned thread_count = 0,
+                std::size_t max_blocks = std::numeric_limits<std::size_t>::max()) {
+        auto blockFunc = [&](std::size_t block, std::size_t first, std::size_t count) {
+            Engine block_rng = monte_carlo_detail::blockEngine<Engine>(checkpoint.seed, block);
+            std::uniform_real_distribution<RNGType> block_dist(dist.param());
+            SampleSequence block_sequence(checkpoint.sampling, checkpoint.seed);
+            return reduceSamples(block_rng, block_dist, block_sequence, first, count);
+        };
+        return monte_carlo_detail::resume(checkpoint, thread_count, max_blocks, blockFunc, reductionFunc);
+    }
 
-        std::vector<DataType> samples(sample_count);
-        std::generate_n(
-          samples.begin(),
-          samples.size(),
-          [&] { return samplingFunc(rngFunc); });
+    // Draws samples until the standard error of their mean drops to 'tolerance'
+    // or the time or sample budget is used up. The estimate is the plain sample
+    // mean, the reduction function is not used.
+    MonteCarloEstimate<DataType> simulateUntil(
+      DataType tolerance,
+      std::chrono::duration<double> time_budget = std::chrono::duration<double>::max(),
+      std::size_t max_samples = std::numeric_limits<std::size_t>::max(),
+      std::size_t min_samples = 1024)
+    {
+        const std::function<RNGType()> rngFunc = [this] () {
+            return monte_carlo_detail::drawUniform(rng, dist, sequence);
+        };
+        return monte_carlo_detail::simulateUntil<DataType>(
+          [&] { sequence.begin(sampleIndex++); return samplingFunc(rngFunc); },
+          tolerance, time_budget, max_samples, min_samples);
+    }
 
-        return std::accumulate(
-          samples.begin(),
-          samples.end(),
-          static_cast<DataType>(0),
-          reductionFunc)
-          / sample_count;
+    // Fixes the seed of all simulations. The serial generator restarts from
+    // the seed, and the result of the parallel simulate becomes reproducible
+    // and independent of the thread count.
+    void setSeed(std::uint64_t seed) {
+        this->seed = seed;
+        this->hasSeed = true;
+        SeedSequence seq(seed);
+        this->rng = Engine(seq);
+        resetSequence();
     }
+    void clearSeed() { this->hasSeed = false; }
+
+    // Selects how the uniform values handed to the sampling function are
+    // drawn. Restarts the sample sequence.
+    void setSampling(Sampling sampling) { this->sampling = sampling; resetSequence(); }
+    Sampling getSampling() const { return sampling; }
 
 protected:
+    // Folds 'count' fresh samples, starting at sample 'first', into a running
+    // reduction without storing them.
+    DataType reduceSamples(Engine& engine, std::uniform_real_distribution<RNGType>& d,
+                           SampleSequence& seq, std::uint64_t first, std::size_t count) const {
+        const std::function<RNGType()> rngFunc = [&] () {
+            return monte_carlo_detail::drawUniform(engine, d, seq);
+        };
+        return monte_carlo_detail::reduceChunked<DataType>(
+          count, [&] { seq.begin(first++); return samplingFunc(rngFunc); }, reductionFunc);
+    }
+
+    void resetSequence() {
+        sequence = SampleSequence(sampling, hasSeed ? seed : ((std::uint64_t)rd() << 32 | rd()));
+        sampleIndex = 0;
+    }
+
     std::random_device                       rd;
-    std::mt19937                             rng;
+    Engine                                   rng;
     std::uniform_real_distribution<RNGType>  dist;
 
     sample_func_t<DataType, RNGType> 	samplingFunc;
     reduction_func_t<DataType> 			reductionFunc;
+
+    std::uint64_t seed = 0;
+    bool hasSeed = false;
+
+    Sampling sampling = Sampling::Uniform;
+    SampleSequence sequence;
+    std::uint64_t sampleIndex = 0;
+};
+
+// Uniform random source handed to the sampler of MonteCarloT.
+// Calling it draws the next value straight from the engine.
+template<typename Engine, typename RNGType>
+struct UniformSource {
+    Engine& engine;
+    std::uniform_real_distribution<RNGType>& dist;
+    SampleSequence& sequence;
+
+    RNGType operator()() { return monte_carlo_detail::drawUniform(engine, dist, sequence); }
+};
+
+// MonteCarlo with the sampler, reducer and engine as template parameters.
+// Nothing goes through std::function, so the sampler is inlined into the
+// sampling loop. The sampler is called as sampler(source) where source()
+// returns the next uniform value; its return type is the data type.
+template<typename Sampler, typename Reducer = std::plus<>,
+         typename Engine = std::mt19937, typename RNGType = double>
+class MonteCarloT {
+public:
+    using source_t = UniformSource<Engine, RNGType>;
+    using data_t = typename std::decay<decltype(std::declval<Sampler&>()(std::declval<source_t&>()))>::type;
+
+    explicit MonteCarloT(Sampler sampler, Reducer reducer = Reducer())
+    : rng(std::random_device()()), sampler(std::move(sampler)), reducer(std::move(reducer))
+    {
+    }
+
+    MonteCarloT(Sampler sampler, Reducer reducer, std::uint64_t seed)
+    : MonteCarloT(std::move(sampler), std::move(reducer))
+    {
+        setSeed(seed);
+    }
+
+    data_t simulate(std::size_t sample_count) {
+        data_t result = reduceSamples(rng, dist, sequence, sampleIndex, sample_count) / sample_count;
+        sampleIndex += sample_count;
+        return result;
+    }
+
+    // Same block layout and seeding as MonteCarlo::simulate(sample_count, thread_count)
+    data_t simulate(std::size_t sample_count, unsigned thread_count) {
+        MonteCarloCheckpoint<data_t> checkpoint = beginRun(sample_count);
+        resume(checkpoint, thread_count);
+        return checkpoint.result();
+    }
+
+    // See MonteCarlo::beginRun and MonteCarlo::resume
+    MonteCarloCheckpoint<data_t> beginRun(std::size_t sample_count) const {
+        MonteCarloCheckpoint<data_t> checkpoint;
+        checkpoint.seed = hasSeed ? seed : monte_carlo_detail::randomSeed();
+        checkpoint.sample_count = sample_count;
+        checkpoint.sampling = sampling;
+        return checkpoint;
+    }
+
+    bool resume(MonteCarloCheckpoint<data_t>& checkpoint, unsigned thread_count = 0,
+                std::size_t max_blocks = std::numeric_limits<std::size_t>::max()) {
+        auto blockFunc = [&](std::size_t block, std::size_t first, std::size_t count) {
+            Engine block_rng = monte_carlo_detail::blockEngine<Engine>(checkpoint.seed, block);
+            std::uniform_real_distribution<RNGType> block_dist(dist.param());
+            SampleSequence block_sequence(checkpoint.sampling, checkpoint.seed);
+            return reduceSamples(block_rng, block_dist, block_sequence, first, count);
+        };
+        return monte_carlo_detail::resume(checkpoint, thread_count, max_blocks, blockFunc, reducer);
+    }
+
+    // See MonteCarlo::simulateUntil
+    MonteCarloEstimate<data_t> simulateUntil(
+      data_t tolerance,
+      std::chrono::duration<double> time_budget = std::chrono::duration<double>::max(),
+      std::size_t max_samples = std::numeric_limits<std::size_t>::max(),
+      std::size_t min_samples = 1024)
+    {
+        source_t source{rng, dist, sequence};
+        return monte_carlo_detail::simulateUntil<data_t>(
+          [&] { sequence.begin(sampleIndex++); return sampler(source); },
+          tolerance, time_budget, max_samples, min_samples);
+    }
+
+    // See MonteCarlo::setSeed
+    void setSeed(std::uint64_t seed) {
+        this->seed = seed;
+        this->hasSeed = true;
+        SeedSequence seq(seed);
+        this->rng = Engine(seq);
+        resetSequence();
+    }
+    void clearSeed() { this->hasSeed = false; }
+
+    // See MonteCarlo::setSampling
+    void setSampling(Sampling sampling) { this->sampling = sampling; resetSequence(); }
+    Sampling getSampling() const { return sampling; }
+
+protected:
+    data_t reduceSamples(Engine& engine, std::uniform_real_distribution<RNGType>& d,
+                         SampleSequence& seq, std::uint64_t first, std::size_t count) const {
+        // every caller works on its own copy, so stateful samplers are safe in parallel runs
+        source_t source{engine, d, seq};
+        Sampler s = sampler;
+        return monte_carlo_detail::reduceChunked<data_t>(
+          count, [&] { seq.begin(first++); return s(source); }, reducer);
+    }
+
+    void resetSequence() {
+        sequence = SampleSequence(sampling, hasSeed ? seed : monte_carlo_detail::randomSeed());
+        sampleIndex = 0;
+    }
+
+    Engine                                   rng;
+    std::uniform_real_distribution<RNGType>  dist;
+
+    Sampler sampler;
+    Reducer reducer;
+
+    std::uint64_t seed = 0;
+    bool hasSeed = false;
+
+    Sampling sampling = Sampling::Uniform;
+    SampleSequence sequence;
+    std::uint64_t sampleIndex = 0;
+};
+
+// Builds a MonteCarloT from its callables, e.g.
+//     auto mc = makeMonteCarlo([](auto& rng) { double x = rng(); return x*x; });
+template<typename RNGType = double, typename Engine = std::mt19937,
+         typename Sampler, typename Reducer = std::plus<>>
+MonteCarloT<Sampler, Reducer, Engine, RNGType> makeMonteCarlo(Sampler sampler, Reducer reducer = Reducer()) {
+    return MonteCarloT<Sampler, Reducer, Engine, RNGType>(std::move(sampler), std::move(reducer));
+}
+
+// MonteCarlo that hands the sampler whole batches of uniform randoms.
+// The sampler is called as sampler(u, out) with
+//     const RNGType (&u)[dims][lanes]  -- coordinate d of lane l is u[d][l]
+//     DataType (&out)[lanes]           -- one sample result per lane
+// so a kernel written as a loop over the lanes vectorizes. The uniforms come
+// from a BatchRNG; the sampling strategies of setSampling() are not available.
+template<typename BatchSampler, int dims, int lanes = 8,
+         typename DataType = double, typename RNGType = double, typename Reducer = std::plus<>>
+class MonteCarloBatch {
+public:
+    explicit MonteCarloBatch(BatchSampler sampler, Reducer reducer = Reducer())
+    : rng(monte_carlo_detail::randomSeed())
+    , sampler(std::move(sampler)), reducer(std::move(reducer))
+    {
+    }
+
+    MonteCarloBatch(BatchSampler sampler, Reducer reducer, std::uint64_t seed)
+    : MonteCarloBatch(std::move(sampler), std::move(reducer))
+    {
+        setSeed(seed);
+    }
+
+    DataType simulate(std::size_t sample_count) {
+        return reduceSamples(rng, sample_count) / sample_count;
+    }
+
+    // Same block layout and seeding scheme as MonteCarlo::simulate(sample_count, thread_count)
+    DataType simulate(std::size_t sample_count, unsigned thread_count) {
+        MonteCarloCheckpoint<DataType> checkpoint = beginRun(sample_count);
+        resume(checkpoint, thread_count);
+        return checkpoint.result();
+    }
+
+    // See MonteCarlo::beginRun and MonteCarlo::resume
+    MonteCarloCheckpoint<DataType> beginRun(std::size_t sample_count) const {
+        MonteCarloCheckpoint<DataType> checkpoint;
+        checkpoint.seed = hasSeed ? seed : monte_carlo_detail::randomSeed();
+        checkpoint.sample_count = sample_count;
+        return checkpoint;
+    }
+
+    bool resume(MonteCarloCheckpoint<DataType>& checkpoint, unsigned thread_count = 0,
+                std::size_t max_blocks = std::numeric_limits<std::size_t>::max()) {
+        auto blockFunc = [&](std::size_t block, std::size_t, std::size_t count) {
+            BatchRNG<lanes> block_rng(SeedSequence(checkpoint.seed).child(block).key());
+            return reduceSamples(block_rng, count);
+        };
+        return monte_carlo_detail::resume(checkpoint, thread_count, max_blocks, blockFunc, reducer);
+    }
+
+    void setSeed(std::uint64_t seed) { this->seed = seed; this->hasSeed = true; rng.seed(seed); }
+    void clearSeed() { this->hasSeed = false; }
+
+protected:
+    // Every lane keeps its own running reduction; the lanes are combined in
+    // order at the end.
+    DataType reduceSamples(BatchRNG<lanes>& engine, std::size_t count) const {
+        RNGType u[dims][lanes];
+        DataType out[lanes];
+        DataType acc[lanes];
+        for(int l = 0; l < lanes; ++l) acc[l] = static_cast<DataType>(0);
+
+        BatchSampler s = sampler;
+        const std::size_t full = count - count % lanes;
+        for(std::size_t i = 0; i < full; i += lanes) {
+            for(int d = 0; d < dims; ++d) engine.uniform(u[d]);
+            s(u, out);
+            for(int l = 0; l < lanes; ++l) acc[l] = reducer(acc[l], out[l]);
+        }
+        if(full < count) {
+            for(int d = 0; d < dims; ++d) engine.uniform(u[d]);
+            s(u, out);
+            for(int l = 0; l < (int)(count - full); ++l) acc[l] = reducer(acc[l], out[l]);
+        }
+        return std::accumulate(acc, acc + lanes, static_cast<DataType>(0), reducer);
+    }
+
+    BatchRNG<lanes> rng;
+
+    BatchSampler sampler;
+    Reducer reducer;
+
+    std::uint64_t seed = 0;
+    bool hasSeed = false;
 };
 
+// Builds a MonteCarloBatch, e.g. for the pi estimator
+//     auto mc = makeMonteCarloBatch<2, 8>([](const double (&u)[2][8], double (&out)[8]) {
+//         for(int l = 0; l < 8; ++l) out[l] = u[0][l]*u[0][l] + u[1][l]*u[1][l] <= 1.0;
+//     });
+template<int dims, int lanes = 8, typename DataType = double, typename RNGType = double,
+         typename BatchSampler, typename Reducer = std::plus<>>
+MonteCarloBatch<BatchSampler, dims, lanes, DataType, RNGType, Reducer>
+makeMonteCarloBatch(BatchSampler sampler, Reducer reducer = Reducer()) {
+    return MonteCarloBatch<BatchSampler, dims, lanes, DataType, RNGType, Reducer>(
+      std::move(sampler), std::move(reducer));
+}
+
 #endif // MONTE_CARLO_H
@@ -1,24 +1,50 @@
 #ifndef RNG_H
 #define RNG_H
 
+#include <algorithm>
 #include <functional>
 #include <random>
 #include <string>
 
-class RNG {
+#include "rng_engines.h"
+#include "simd_rng.h"
+
+// Engine is any standard-conforming engine, e.g. std::mt19937 (the RNG
+// default), Xoshiro256StarStar, PCG64 or SplitMix64.
+template<typename Engine = std::mt19937>
+class BasicRNG {
 public:
-    RNG(std::pair<int, int> intRange = {0, 100},
+    using engine_type = Engine;
+
+    // Seeded from std::random_device
+    BasicRNG(std::pair<int, int> intRange = {0, 100},
+        std::pair<float, float> floatRange = {0.0f, 1.0f},
+        std::pair<double, double> doubleRange = {0.0, 1.0})
+        : BasicRNG(SeedSequence(randomSeed()), intRange, floatRange, doubleRange)
+    {
+    }
+
+    // Reproducible: the same seed always gives the same values
+    explicit BasicRNG(std::uint64_t seed)
+        : BasicRNG(SeedSequence(seed))
+    {
+    }
+
+    explicit BasicRNG(const SeedSequence& seq,
+        std::pair<int, int> intRange = {0, 100},
         std::pair<float, float> floatRange = {0.0f, 1.0f},
         std::pair<double, double> doubleRange = {0.0, 1.0})
-        : rng(this->rd())
+        : seedSeq(seq)
+        , rng(seedSeq)
         , iDist(intRange.first, intRange.second)
         , fDist(floatRange.first, floatRange.second)
         , dDist(doubleRange.first, doubleRange.second)
+        , bulk(((std::uint64_t)rng() << 32) ^ rng())
     {
     }
 
-    explicit RNG(float lower, float upper)
-        : RNG({(int)lower,(int)upper}, {(float)lower, (float)upper}, {(double)lower, (double)upper})
+    explicit BasicRNG(float lower, float upper)
+        : BasicRNG({(int)lower,(int)upper}, {(float)lower, (float)upper}, {(double)lower, (double)upper})
     {
     }
 
@@ -28,19 +54,117 @@ public:
     inline double getDouble() { return this->dDist(this->rng); }
     inline int getInt() { return this->iDist(this->rng); }
 
-    inline std::mt19937 getGenerator() const { return this->rng; }
+    inline Engine getGenerator() const { return this->rng; }
+
+    void seed(std::uint64_t seed) { this->seed(SeedSequence(seed)); }
+
+    void seed(const SeedSequence& seq) {
+        this->seedSeq = seq;
+        this->rng = Engine(this->seedSeq);
+        this->bulk.seed(((std::uint64_t)rng() << 32) ^ rng());
+    }
+
+    const SeedSequence& getSeedSequence() const { return this->seedSeq; }
+
+    // Independent child generator with the same ranges. The n-th spawn of a
+    // seeded RNG is always the same, so per-thread generators handed out
+    // with spawn() keep a parallel run reproducible.
+    BasicRNG spawn() {
+        return BasicRNG(this->seedSeq.spawn(), {iDist.a(), iDist.b()}, {fDist.a(), fDist.b()}, {dDist.a(), dDist.b()});
+    }
+
+    // Binary snapshot of the complete generator state (engine, bulk generator,
+    // ranges and seed sequence). restoreState() continues exactly where the
+    // snapshot was taken; it returns false and leaves the object untouched if
+    // 'state' was not produced by saveState() of the same BasicRNG type.
+    std::string saveState() const {
+        std::string out;
+        rng_detail::putBytes(out, state_magic);
+        saveEngine(out, this->rng);
+        saveEngine(out, this->bulk);
+        rng_detail::putBytes(out, iDist.param());
+        rng_detail::putBytes(out, fDist.param());
+        rng_detail::putBytes(out, dDist.param());
+        rng_detail::putBytes(out, bDist.param());
+        this->seedSeq.save(out);
+        return out;
+    }
+
+    bool restoreState(const std::string& state) {
+        std::size_t pos = 0;
+        std::uint32_t magic = 0;
+        if(!rng_detail::getBytes(state, pos, magic) || magic != state_magic)
+            return false;
+
+        BasicRNG copy(*this);
+        typename std::uniform_int_distribution<int>::param_type ip;
+        typename std::uniform_real_distribution<float>::param_type fp;
+        typename std::uniform_real_distribution<double>::param_type dp;
+        std::bernoulli_distribution::param_type bp;
+        if(!loadEngine(state, pos, copy.rng) || !loadEngine(state, pos, copy.bulk) ||
+           !rng_detail::getBytes(state, pos, ip) || !rng_detail::getBytes(state, pos, fp) ||
+           !rng_detail::getBytes(state, pos, dp) || !rng_detail::getBytes(state, pos, bp) ||
+           !copy.seedSeq.load(state, pos) || pos != state.size())
+            return false;
+
+        copy.iDist.param(ip);
+        copy.fDist.param(fp);
+        copy.dDist.param(dp);
+        copy.bDist.param(bp);
+        *this = std::move(copy);
+        return true;
+    }
+
+    // Bulk fills using the ranges of the matching get functions. They draw from
+    // a separate vectorized generator seeded from this one, so they skip the
+    // per-call distribution overhead.
+    void fillFloats(float* out, std::size_t n) { this->bulk.fillUniform(out, n, fDist.a(), fDist.b()); }
+    void fillDoubles(double* out, std::size_t n) { this->bulk.fillUniform(out, n, dDist.a(), dDist.b()); }
+    void fillInts(int* out, std::size_t n) { this->bulk.fillInts(out, n, iDist.a(), iDist.b()); }
+
+    // n random bools packed into (n+63)/64 words, bit i in bits[i/64] >> (i%64)
+    void fillBools(std::uint64_t* bits, std::size_t n) { this->bulk.fillBits(bits, n); }
 
     std::string getString(std::string::size_type length = 10) {
+        std::string ret(length, '\0');
+        generateStrings(&ret[0], 1, length);
+        return ret;
+    }
+
+    // Writes 'count' random alphanumeric keys of 'length' characters back to
+    // back into 'out' (count*length chars, no terminators). Every 64-bit word
+    // gives 8 characters by repeated multiply-shift by the charset size; the
+    // resulting bias is below 2^-16 per character. Uses only this object's
+    // state, so per-thread RNGs can call it concurrently.
+    void generateStrings(char* out, std::size_t count, std::size_t length) {
         static const char charset[] = "0123456789"
                                       "abcdefghijklmnopqrstuvwxyz"
                                       "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-        static std::uniform_int_distribution<> strIntDist(0, sizeof(charset) - 2);
-        static auto getCharacter = [=]() -> char { return charset[strIntDist(this->rng)]; };
+        const std::uint64_t charset_size = sizeof(charset) - 1;
+        constexpr int chars_per_word = 8;
+        constexpr std::size_t batch = 64;
 
-        std::string ret;
-        ret.reserve(length);
-        std::generate_n(std::back_inserter(ret), length, getCharacter);
+        std::uint64_t words[batch];
+        std::size_t total = count * length;
+        while(total) {
+            const std::size_t chars = std::min(total, batch * chars_per_word);
+            this->bulk.fill(words, (chars + chars_per_word - 1) / chars_per_word);
 
+            for(std::size_t i = 0; i < chars; ++i) {
+                std::uint64_t& x = words[i / chars_per_word];
+                const rng_detail::uint128_t r = (rng_detail::uint128_t)x * charset_size;
+                out[i] = charset[(std::size_t)(r >> 64)];
+                x = (std::uint64_t)r;
+            }
+            out += chars;
+            total -= chars;
+        }
+    }
+
+    // Same as above, returned as one contiguous string; key i starts at i*length
+    std::string generateStrings(std::size_t count, std::size_t length) {
+        std::string ret(count * length, '\0');
+        generateStrings(&ret[0], count, length);
         return ret;
     }
 
@@ -52,13 +176,27 @@ public:
     int Rand(int n) { return std::uniform_int_distribution<>(0,n)(this->rng);}
 
 private:
-    std::random_device rd;
-    std::mt19937 rng;
+    static constexpr std::uint32_t state_magic = 0x31474e52; // "RNG1"
+
+    static std::uint64_t randomSeed() {
+        std::random_device rd;
+        return ((std::uint64_t)rd() << 32) ^ rd();
+    }
+
+    SeedSequence seedSeq;
+    Engine rng;
 
     std::uniform_int_distribution<int> iDist;
     std::uniform_real_distribution<float> fDist;
     std::uniform_real_distribution<double> dDist;
     std::bernoulli_distribution bDist;
+
+    BatchRNG<8> bulk;
 };
 
+template<typename Engine>
+constexpr std::uint32_t BasicRNG<Engine>::state_magic;
+
+using RNG = BasicRNG<>;
+
 #endif // RNG_H
@@ -0,0 +1,367 @@
+#ifndef RNG_ENGINES_H
+#define RNG_ENGINES_H
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Small, fast non-cryptographic engines. They satisfy the standard
+// UniformRandomBitGenerator requirements, so they work with the <random>
+// distributions, and can be seeded from a single integer or a seed sequence.
+
+namespace rng_detail {
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+template<typename T>
+using enable_if_sseq_t = typename std::enable_if<!std::is_convertible<T, std::uint64_t>::value>::type;
+
+// Fills 'words' 64-bit values from a standard seed sequence
+template<typename Sseq>
+void generateWords(Sseq& seq, std::uint64_t* out, int words) {
+    std::uint32_t halves[16];
+    seq.generate(halves, halves + 2*words);
+    for(int i = 0; i < words; ++i)
+        out[i] = ((std::uint64_t)halves[2*i + 1] << 32) | halves[2*i];
+}
+
+inline std::uint64_t mix64(std::uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Raw byte (de)serialization of trivially copyable values
+template<typename T>
+void putBytes(std::string& out, const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "putBytes needs a trivially copyable type");
+    out.append((const char*)&value, sizeof(T));
+}
+
+template<typename T>
+bool getBytes(const std::string& in, std::size_t& pos, T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "getBytes needs a trivially copyable type");
+    if(in.size() < pos + sizeof(T)) return false;
+    std::memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+template<typename Engine>
+void saveEngine(std::string& out, const Engine& engine, std::true_type) { putBytes(out, engine); }
+
+template<typename Engine>
+void saveEngine(std::string& out, const Engine& engine, std::false_type) {
+    std::ostringstream ss;
+    ss << engine;
+    const std::uint64_t size = ss.str().size();
+    putBytes(out, size);
+    out += ss.str();
+}
+
+template<typename Engine>
+bool loadEngine(const std::string& in, std::size_t& pos, Engine& engine, std::true_type) {
+    return getBytes(in, pos, engine);
+}
+
+template<typename Engine>
+bool loadEngine(const std::string& in, std::size_t& pos, Engine& engine, std::false_type) {
+    std::uint64_t size = 0;
+    if(!getBytes(in, pos, size) || size > in.size() - pos) return false;
+    std::istringstream ss(in.substr(pos, size));
+    ss >> engine;
+    pos += size;
+    return !ss.fail();
+}
+
+} //namespace rng_detail
+
+// Appends a binary snapshot of 'engine' to 'out'. Trivially copyable engines
+// (the ones below and the libstdc++ <random> engines) are stored byte for
+// byte; others go through their stream operators. The snapshot is meant to
+// be restored by the same build, it is not a portable file format.
+template<typename Engine>
+void saveEngine(std::string& out, const Engine& engine) {
+    rng_detail::saveEngine(out, engine, std::is_trivially_copyable<Engine>());
+}
+
+// Restores an engine saved at 'pos' of 'in' and moves 'pos' past it.
+// Returns false if 'in' is too short or malformed.
+template<typename Engine>
+bool loadEngine(const std::string& in, std::size_t& pos, Engine& engine) {
+    return rng_detail::loadEngine(in, pos, engine, std::is_trivially_copyable<Engine>());
+}
+
+// splitmix64, 64 bits of state. Mostly used to expand a single seed into the
+// state of the other engines. advance(n) skips n outputs in O(1).
+class SplitMix64 {
+public:
+    using result_type = std::uint64_t;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    explicit SplitMix64(std::uint64_t seed = 0) : state_(seed) { }
+
+    template<typename Sseq, typename = rng_detail::enable_if_sseq_t<Sseq>>
+    explicit SplitMix64(Sseq& seq) { rng_detail::generateWords(seq, &state_, 1); }
+
+    void seed(std::uint64_t seed) { state_ = seed; }
+
+    result_type operator()() {
+        return rng_detail::mix64(state_ += 0x9e3779b97f4a7c15ULL);
+    }
+
+    void discard(unsigned long long n) { advance(n); }
+    void advance(std::uint64_t n) { state_ += n * 0x9e3779b97f4a7c15ULL; }
+
+    std::uint64_t state() const { return state_; }
+
+    bool operator==(const SplitMix64& other) const { return state_ == other.state_; }
+    bool operator!=(const SplitMix64& other) const { return !(*this == other); }
+
+private:
+    std::uint64_t state_;
+};
+
+// xoshiro256** (Blackman & Vigna), 256 bits of state, period 2^256 - 1.
+// jump() advances the state by 2^128 outputs and longJump() by 2^192, so
+// repeatedly jumping a copy hands out non-overlapping streams.
+class Xoshiro256StarStar {
+public:
+    using result_type = std::uint64_t;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    explicit Xoshiro256StarStar(std::uint64_t seed = 0) { this->seed(seed); }
+
+    template<typename Sseq, typename = rng_detail::enable_if_sseq_t<Sseq>>
+    explicit Xoshiro256StarStar(Sseq& seq) {
+        rng_detail::generateWords(seq, s_, 4);
+        if(!(s_[0] | s_[1] | s_[2] | s_[3])) s_[0] = 1; // the all-zero state is a fixed point
+    }
+
+    void seed(std::uint64_t seed) {
+        SplitMix64 sm(seed);
+        for(int i = 0; i < 4; ++i) s_[i] = sm();
+    }
+
+    result_type operator()() {
+        const std::uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        const std::uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+        return result;
+    }
+
+    void discard(unsigned long long n) { for(; n; --n) (*this)(); }
+
+    void jump() {
+        static const std::uint64_t poly[4] = {
+            0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+        };
+        applyJump(poly);
+    }
+
+    void longJump() {
+        static const std::uint64_t poly[4] = {
+            0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL
+        };
+        applyJump(poly);
+    }
+
+    const std::uint64_t* state() const { return s_; }
+
+    bool operator==(const Xoshiro256StarStar& other) const {
+        return s_[0] == other.s_[0] && s_[1] == other.s_[1] && s_[2] == other.s_[2] && s_[3] == other.s_[3];
+    }
+    bool operator!=(const Xoshiro256StarStar& other) const { return !(*this == other); }
+
+private:
+    static std::uint64_t rotl(std::uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    void applyJump(const std::uint64_t (&poly)[4]) {
+        std::uint64_t t[4] = {0, 0, 0, 0};
+        for(int i = 0; i < 4; ++i)
+            for(int b = 0; b < 64; ++b) {
+                if(poly[i] & (1ULL << b))
+                    for(int k = 0; k < 4; ++k) t[k] ^= s_[k];
+                (*this)();
+            }
+        for(int k = 0; k < 4; ++k) s_[k] = t[k];
+    }
+
+    std::uint64_t s_[4];
+};
+
+// PCG64 (O'Neill): 128-bit LCG with the XSL-RR output function.
+// Every odd increment selects a different stream. advance(n) skips n outputs
+// in O(log n); jump() skips 2^64 and longJump() 2^96 outputs.
+class PCG64 {
+public:
+    using result_type = std::uint64_t;
+    using state_type = rng_detail::uint128_t;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    explicit PCG64(std::uint64_t seed = 0, std::uint64_t stream = 0) { this->seed(seed, stream); }
+
+    template<typename Sseq, typename = rng_detail::enable_if_sseq_t<Sseq>>
+    explicit PCG64(Sseq& seq) {
+        std::uint64_t w[4];
+        rng_detail::generateWords(seq, w, 4);
+        init(((state_type)w[0] << 64) | w[1], ((state_type)w[2] << 64) | w[3]);
+    }
+
+    void seed(std::uint64_t seed, std::uint64_t stream = 0) {
+        SplitMix64 sm(seed);
+        std::uint64_t hi = sm(), lo = sm();
+        init(((state_type)hi << 64) | lo, ((state_type)stream << 64) | SplitMix64(stream)());
+    }
+
+    result_type operator()() {
+        state_ = state_ * multiplier() + inc_;
+        const std::uint64_t x = (std::uint64_t)(state_ >> 64) ^ (std::uint64_t)state_;
+        const int rot = (int)(state_ >> 122);
+        return (x >> rot) | (x << ((64 - rot) & 63));
+    }
+
+    void discard(unsigned long long n) { advance(n); }
+
+    void advance(state_type n) {
+        state_type acc_mult = 1, acc_plus = 0;
+        state_type cur_mult = multiplier(), cur_plus = inc_;
+        for(; n; n >>= 1) {
+            if(n & 1) {
+                acc_mult *= cur_mult;
+                acc_plus = acc_plus * cur_mult + cur_plus;
+            }
+            cur_plus = (cur_mult + 1) * cur_plus;
+            cur_mult *= cur_mult;
+        }
+        state_ = acc_mult * state_ + acc_plus;
+    }
+
+    void jump() { advance((state_type)1 << 64); }
+    void longJump() { advance((state_type)1 << 96); }
+
+    state_type state() const { return state_; }
+    state_type increment() const { return inc_; }
+
+    bool operator==(const PCG64& other) const { return state_ == other.state_ && inc_ == other.inc_; }
+    bool operator!=(const PCG64& other) const { return !(*this == other); }
+
+private:
+    static state_type multiplier() {
+        return ((state_type)0x2360ed051fc65da4ULL << 64) | 0x4385df649fccf645ULL;
+    }
+
+    void init(state_type initstate, state_type initseq) {
+        state_ = 0;
+        inc_ = (initseq << 1) | 1;
+        (*this)();
+        state_ += initstate;
+        (*this)();
+    }
+
+    state_type state_;
+    state_type inc_;
+};
+
+// Deterministic, hierarchical seed derivation. A sequence is identified by its
+// root entropy and its path of child indices; child(i) and spawn() derive new
+// sequences whose output is unrelated to the parent's and the siblings'. That
+// gives every thread, block or sub-simulation its own reproducible stream
+// from a single root seed. It can seed any engine that accepts a standard
+// seed sequence (generate(), size(), param()).
+class SeedSequence {
+public:
+    using result_type = std::uint32_t;
+
+    explicit SeedSequence(std::uint64_t entropy = 0) : entropy_(entropy) { }
+
+    // Child 'index' of this sequence; does not change this sequence
+    SeedSequence child(std::uint64_t index) const {
+        SeedSequence c(entropy_);
+        c.path_ = path_;
+        c.path_.push_back(index);
+        return c;
+    }
+
+    // Next child in order: child(0), child(1), ...
+    SeedSequence spawn() { return child(spawned_++); }
+
+    // 64-bit digest of the entropy and the path
+    std::uint64_t key() const {
+        std::uint64_t h = rng_detail::mix64(entropy_ ^ 0x6a09e667f3bcc908ULL);
+        for(std::uint64_t index : path_)
+            h = rng_detail::mix64(h ^ rng_detail::mix64(index + 0x9e3779b97f4a7c15ULL));
+        return h;
+    }
+
+    template<typename Iterator>
+    void generate(Iterator begin, Iterator end) const {
+        SplitMix64 sm(key());
+        while(begin != end) {
+            const std::uint64_t w = sm();
+            *begin++ = (std::uint32_t)w;
+            if(begin != end) *begin++ = (std::uint32_t)(w >> 32);
+        }
+    }
+
+    std::size_t size() const { return 2 + 2*path_.size(); }
+
+    template<typename OutputIterator>
+    void param(OutputIterator out) const {
+        *out++ = (std::uint32_t)entropy_;
+        *out++ = (std::uint32_t)(entropy_ >> 32);
+        for(std::uint64_t index : path_) {
+            *out++ = (std::uint32_t)index;
+            *out++ = (std::uint32_t)(index >> 32);
+        }
+    }
+
+    std::uint64_t entropy() const { return entropy_; }
+    const std::vector<std::uint64_t>& path() const { return path_; }
+
+    void save(std::string& out) const {
+        rng_detail::putBytes(out, entropy_);
+        rng_detail::putBytes(out, spawned_);
+        rng_detail::putBytes(out, (std::uint64_t)path_.size());
+        for(std::uint64_t index : path_) rng_detail::putBytes(out, index);
+    }
+
+    bool load(const std::string& in, std::size_t& pos) {
+        std::uint64_t entropy = 0, spawned = 0, depth = 0;
+        if(!rng_detail::getBytes(in, pos, entropy) || !rng_detail::getBytes(in, pos, spawned) ||
+           !rng_detail::getBytes(in, pos, depth))
+            return false;
+        // divided rather than multiplied: a corrupt depth must not wrap around
+        if(depth > (in.size() - pos) / sizeof(std::uint64_t)) return false;
+
+        std::vector<std::uint64_t> path(depth);
+        for(std::uint64_t& index : path) rng_detail::getBytes(in, pos, index);
+
+        entropy_ = entropy;
+        spawned_ = spawned;
+        path_.swap(path);
+        return true;
+    }
+
+private:
+    std::uint64_t entropy_;
+    std::uint64_t spawned_ = 0;
+    std::vector<std::uint64_t> path_;
+};
+
+#endif // RNG_ENGINES_H
@@ -0,0 +1,227 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "rng_engines.h"
+
+// Strategies for the uniform coordinates a MonteCarlo sampler receives.
+// A sample is the sequence of values returned by rng() during one call of the
+// sampling function; its k-th value is coordinate k of the sample point.
+enum class Sampling {
+    Uniform,        // independent uniform draws
+    LatinHypercube, // every 'lhs_strata' samples hit each stratum of every coordinate once
+    Antithetic,     // odd samples mirror the preceding even sample (u -> 1-u)
+    Halton,         // randomly shifted Halton sequence
+    Sobol,          // digitally shifted Sobol sequence (Joe-Kuo direction numbers)
+};
+
+namespace sampling_detail {
+
+constexpr int halton_dims = 32;
+constexpr int sobol_dims = 16;
+constexpr int sobol_bits = 32;
+
+// The largest double below 1, for results that rounding could take to 1.0
+constexpr double below_one = 1.0 - 1.0 / (1ULL << 53);
+
+inline const int* haltonPrimes() {
+    static const int primes[halton_dims] = {
+        2,  3,  5,  7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+       59, 61, 67, 71, 73, 79, 83, 89, 97,101,103,107,109,113,127,131
+    };
+    return primes;
+}
+
+// Direction numbers for the first 'sobol_dims' dimensions
+struct SobolTable {
+    std::uint32_t v[sobol_dims][sobol_bits];
+
+    SobolTable() {
+        // degree s, coefficients a and initial m_k of the primitive polynomials
+        // for dimensions 2.. (new-joe-kuo-6.21201)
+        static const struct { int s, a; std::uint32_t m[6]; } poly[sobol_dims - 1] = {
+            {1,  0, {1}},
+            {2,  1, {1, 3}},
+            {3,  1, {1, 3, 1}},
+            {3,  2, {1, 1, 1}},
+            {4,  1, {1, 1, 3, 3}},
+            {4,  4, {1, 3, 5, 13}},
+            {5,  2, {1, 1, 5, 5, 17}},
+            {5,  4, {1, 1, 5, 5, 5}},
+            {5,  7, {1, 1, 7, 11, 19}},
+            {5, 11, {1, 1, 5, 1, 1}},
+            {5, 13, {1, 1, 1, 3, 11}},
+            {5, 14, {1, 3, 5, 5, 31}},
+            {6,  1, {1, 3, 3, 9, 7, 49}},
+            {6, 13, {1, 1, 1, 15, 21, 21}},
+            {6, 16, {1, 3, 1, 13, 27, 49}},
+        };
+
+        for(int k = 0; k < sobol_bits; ++k) v[0][k] = 1u << (sobol_bits - 1 - k);
+
+        for(int d = 1; d < sobol_dims; ++d) {
+            const int s = poly[d-1].s, a = poly[d-1].a;
+            for(int k = 0; k < s; ++k) v[d][k] = poly[d-1].m[k] << (sobol_bits - 1 - k);
+            for(int k = s; k < sobol_bits; ++k) {
+                v[d][k] = v[d][k-s] ^ (v[d][k-s] >> s);
+                for(int j = 1; j < s; ++j)
+                    if((a >> (s - 1 - j)) & 1) v[d][k] ^= v[d][k-j];
+            }
+        }
+    }
+};
+
+inline const SobolTable& sobolTable() {
+    static const SobolTable table;
+    return table;
+}
+
+} //namespace sampling_detail
+
+// Coordinates of consecutive sample points for one sampling strategy.
+// Call begin(i) before sample i and next(engine) for each of its coordinates.
+// The quasi-random sequences are indexed by the global sample index, so
+// independently seeded blocks of one run (same 'seed') form one point set.
+// Coordinates past the supported dimensions of Halton (32) and Sobol (16)
+// fall back to independent uniform draws.
+class SampleSequence {
+public:
+    static constexpr std::uint64_t lhs_strata = 1024;
+    static constexpr int antithetic_dims = 64;
+
+    explicit SampleSequence(Sampling sampling = Sampling::Uniform, std::uint64_t seed = 0)
+        : sampling_(sampling)
+    {
+        namespace sd = sampling_detail;
+        SplitMix64 shifts(seed);
+        for(int d = 0; d < sd::halton_dims; ++d)
+            haltonShift_[d] = (shifts() >> 11) * (1.0 / (1ULL << 53));
+        for(int d = 0; d < sd::sobol_dims; ++d) {
+            sobolShift_[d] = (std::uint32_t)(shifts() >> 32);
+            sobolIndex_[d] = ~0ULL;
+        }
+    }
+
+    Sampling sampling() const { return sampling_; }
+
+    void begin(std::uint64_t index) {
+        index_ = index;
+        dim_ = 0;
+    }
+
+    // Next coordinate of the current sample in [0,1)
+    template<typename Engine>
+    double next(Engine& engine) {
+        const int d = dim_++;
+        switch(sampling_) {
+        case Sampling::LatinHypercube:
+            return latinHypercube(engine, d);
+        case Sampling::Antithetic:
+            return antithetic(engine, d);
+        case Sampling::Halton:
+            return d < sampling_detail::halton_dims ? halton(d) : uniform(engine);
+        case Sampling::Sobol:
+            return d < sampling_detail::sobol_dims ? sobol(d) : uniform(engine);
+        case Sampling::Uniform:
+        default:
+            return uniform(engine);
+        }
+    }
+
+private:
+    template<typename Engine>
+    static double uniform(Engine& engine) {
+        // generate_canonical may round up to 1.0 (LWG 2524)
+        return std::min(std::uniform_real_distribution<double>(0.0, 1.0)(engine), sampling_detail::below_one);
+    }
+
+    template<typename Engine>
+    double latinHypercube(Engine& engine, int d) {
+        if(d >= (int)lhsPerms_.size()) {
+            lhsPerms_.resize(d + 1);
+            lhsBlock_.resize(d + 1, ~0ULL);
+        }
+
+        std::vector<std::uint16_t>& perm = lhsPerms_[d];
+        const std::uint64_t block = index_ / lhs_strata;
+        if(lhsBlock_[d] != block) {
+            perm.resize(lhs_strata);
+            for(std::uint64_t i = 0; i < lhs_strata; ++i) perm[i] = (std::uint16_t)i;
+            std::shuffle(perm.begin(), perm.end(), engine);
+            lhsBlock_[d] = block;
+        }
+        return std::min((perm[index_ % lhs_strata] + uniform(engine)) / lhs_strata, sampling_detail::below_one);
+    }
+
+    template<typename Engine>
+    double antithetic(Engine& engine, int d) {
+        if(d >= antithetic_dims) return uniform(engine);
+
+        if((index_ & 1) && pairIndex_ + 1 == index_ && d < pairDims_)
+            return std::min(1.0 - pair_[d], sampling_detail::below_one); // u == 0 mirrors to 1
+
+        double u = uniform(engine);
+        if(!(index_ & 1)) {
+            if(d == 0) pairIndex_ = index_;
+            pair_[d] = u;
+            pairDims_ = d + 1;
+        }
+        return u;
+    }
+
+    double halton(int d) const {
+        const int base = sampling_detail::haltonPrimes()[d];
+        const double inv_base = 1.0 / base;
+
+        double result = 0, f = inv_base;
+        for(std::uint64_t i = index_; i; i /= base, f *= inv_base)
+            result += f * (i % base);
+
+        result += haltonShift_[d];
+        return result >= 1.0 ? result - 1.0 : result;
+    }
+
+    double sobol(int d) {
+        const sampling_detail::SobolTable& table = sampling_detail::sobolTable();
+        const std::uint64_t i = index_ & 0xffffffffULL;
+
+        // consecutive points differ in the direction number of the lowest set bit
+        if(i != 0 && sobolIndex_[d] + 1 == i) {
+            int k = 0;
+            while(!((i >> k) & 1)) ++k;
+            sobolState_[d] ^= table.v[d][k];
+        }
+        else if(sobolIndex_[d] != i) {
+            const std::uint64_t gray = i ^ (i >> 1);
+            std::uint32_t x = 0;
+            for(int k = 0; k < sampling_detail::sobol_bits; ++k)
+                if((gray >> k) & 1) x ^= table.v[d][k];
+            sobolState_[d] = x;
+        }
+        sobolIndex_[d] = i;
+
+        return (sobolState_[d] ^ sobolShift_[d]) * (1.0 / (1ULL << 32));
+    }
+
+    Sampling sampling_;
+    std::uint64_t index_ = 0;
+    int dim_ = 0;
+
+    std::vector<std::vector<std::uint16_t>> lhsPerms_;
+    std::vector<std::uint64_t> lhsBlock_;
+
+    double pair_[antithetic_dims];
+    int pairDims_ = 0;
+    std::uint64_t pairIndex_ = ~0ULL;
+
+    double haltonShift_[sampling_detail::halton_dims];
+    std::uint32_t sobolShift_[sampling_detail::sobol_dims];
+    std::uint32_t sobolState_[sampling_detail::sobol_dims] = {};
+    std::uint64_t sobolIndex_[sampling_detail::sobol_dims];
+};
+
+#endif // SAMPLING_H
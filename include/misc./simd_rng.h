@@ -0,0 +1,247 @@
+#ifndef SIMD_RNG_H
+#define SIMD_RNG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "rng_engines.h"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// 'lanes' independent xoshiro256+ generators stepped in lockstep, so one step
+// produces 'lanes' random words with a handful of vector instructions.
+// The state is stored lane-interleaved: s[k][lane] is word k of a lane.
+// Groups of 8 lanes are stepped with AVX-512 and groups of 4 with AVX2 when
+// available; the remaining lanes use a plain loop.
+template<int lanes = 8>
+class BatchRNG {
+public:
+    static_assert(lanes > 0, "BatchRNG needs at least one lane");
+
+    explicit BatchRNG(std::uint64_t seed = 0) { this->seed(seed); }
+
+    // Lane l starts 'l' jumps (2^128 steps each) into the stream of 'seed',
+    // so the lanes never overlap.
+    void seed(std::uint64_t seed) {
+        Xoshiro256StarStar base(seed);
+        for(int l = 0; l < lanes; ++l) {
+            for(int k = 0; k < 4; ++k) s[k][l] = base.state()[k];
+            base.jump();
+        }
+    }
+
+    // One random word per lane
+    void next(std::uint64_t (&out)[lanes]) {
+        int l = 0;
+#if defined(__AVX512F__)
+        for(; l + 8 <= lanes; l += 8) {
+            __m512i r = step512(l);
+            _mm512_storeu_si512((void*)(out + l), r);
+        }
+#endif
+#if defined(__AVX2__)
+        for(; l + 4 <= lanes; l += 4) {
+            __m256i r = step256(l);
+            _mm256_storeu_si256((__m256i*)(out + l), r);
+        }
+#endif
+        for(; l < lanes; ++l) out[l] = stepScalar(l);
+    }
+
+    // One double in [0,1) per lane. The top 52 bits of each word become the
+    // mantissa of a double in [1,2), so no integer to float division is needed.
+    void uniform(double (&out)[lanes]) {
+        int l = 0;
+#if defined(__AVX512F__)
+        for(; l + 8 <= lanes; l += 8) {
+            __m512i bits = _mm512_or_si512(_mm512_srli_epi64(step512(l), 12),
+                                           _mm512_set1_epi64(0x3ff0000000000000LL));
+            _mm512_storeu_pd(out + l, _mm512_sub_pd(_mm512_castsi512_pd(bits), _mm512_set1_pd(1.0)));
+        }
+#endif
+#if defined(__AVX2__)
+        for(; l + 4 <= lanes; l += 4) {
+            __m256i bits = _mm256_or_si256(_mm256_srli_epi64(step256(l), 12),
+                                           _mm256_set1_epi64x(0x3ff0000000000000LL));
+            _mm256_storeu_pd(out + l, _mm256_sub_pd(_mm256_castsi256_pd(bits), _mm256_set1_pd(1.0)));
+        }
+#endif
+        for(; l < lanes; ++l) out[l] = toDouble(stepScalar(l));
+    }
+
+    // One float in [0,1) per lane, from the top 23 bits of each word
+    void uniform(float (&out)[lanes]) {
+        int l = 0;
+#if defined(__AVX512F__)
+        for(; l + 8 <= lanes; l += 8) {
+            __m256i bits = _mm256_or_si256(_mm512_cvtepi64_epi32(_mm512_srli_epi64(step512(l), 41)),
+                                           _mm256_set1_epi32(0x3f800000));
+            _mm256_storeu_ps(out + l, _mm256_sub_ps(_mm256_castsi256_ps(bits), _mm256_set1_ps(1.0f)));
+        }
+#endif
+#if defined(__AVX2__)
+        for(; l + 4 <= lanes; l += 4) {
+            __m256i words = _mm256_permutevar8x32_epi32(_mm256_srli_epi64(step256(l), 41),
+                                                        _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+            __m128i bits = _mm_or_si128(_mm256_castsi256_si128(words), _mm_set1_epi32(0x3f800000));
+            _mm_storeu_ps(out + l, _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.0f)));
+        }
+#endif
+        for(; l < lanes; ++l) out[l] = toFloat((std::uint32_t)(stepScalar(l) >> 41));
+    }
+
+    // Bulk fills. The word conversions run over whole batches of 'lanes'
+    // words in plain loops that the compiler vectorizes.
+
+    // n random words
+    void fill(std::uint64_t* out, std::size_t n) {
+        std::uint64_t words[lanes];
+        for(; n >= (std::size_t)lanes; n -= lanes, out += lanes) next(*(std::uint64_t(*)[lanes])out);
+        if(n) {
+            next(words);
+            std::memcpy(out, words, n * sizeof(std::uint64_t));
+        }
+    }
+
+    // n doubles uniform in [lower, upper)
+    void fillUniform(double* out, std::size_t n, double lower = 0.0, double upper = 1.0) {
+        const double scale = upper - lower;
+        std::uint64_t words[lanes];
+        while(n) {
+            next(words);
+            const int count = n < (std::size_t)lanes ? (int)n : lanes;
+            for(int l = 0; l < count; ++l) out[l] = lower + scale * toDouble(words[l]);
+            out += count;
+            n -= count;
+        }
+    }
+
+    // n floats uniform in [lower, upper). Every word yields two floats.
+    void fillUniform(float* out, std::size_t n, float lower = 0.0f, float upper = 1.0f) {
+        const float scale = upper - lower;
+        std::uint64_t words[lanes];
+        float f[2*lanes];
+        for(; n >= (std::size_t)(2*lanes); n -= 2*lanes, out += 2*lanes) {
+            next(words);
+            for(int l = 0; l < lanes; ++l) {
+                out[l]         = lower + scale * toFloat((std::uint32_t)(words[l] >> 41));
+                out[l + lanes] = lower + scale * toFloat((std::uint32_t)(words[l] >> 9));
+            }
+        }
+        if(n) {
+            next(words);
+            for(int l = 0; l < lanes; ++l) {
+                f[l]         = lower + scale * toFloat((std::uint32_t)(words[l] >> 41));
+                f[l + lanes] = lower + scale * toFloat((std::uint32_t)(words[l] >> 9));
+            }
+            std::memcpy(out, f, n * sizeof(float));
+        }
+    }
+
+    // n integers in [lower, upper] (inclusive). Every word yields two values,
+    // each mapped with a 32x32->64 bit multiply-shift instead of a modulo.
+    // The bias of skipping the rejection step is below (range / 2^32).
+    void fillInts(int* out, std::size_t n, int lower, int upper) {
+        const std::uint64_t range = (std::uint64_t)((std::int64_t)upper - lower) + 1;
+        auto map = [&](std::uint32_t x) { return (int)(lower + (std::int64_t)((x * range) >> 32)); };
+
+        std::uint64_t words[lanes];
+        int v[2*lanes];
+        for(; n >= (std::size_t)(2*lanes); n -= 2*lanes, out += 2*lanes) {
+            next(words);
+            for(int l = 0; l < lanes; ++l) {
+                out[l]         = map((std::uint32_t)(words[l] >> 32));
+                out[l + lanes] = map((std::uint32_t)words[l]);
+            }
+        }
+        if(n) {
+            next(words);
+            for(int l = 0; l < lanes; ++l) {
+                v[l]         = map((std::uint32_t)(words[l] >> 32));
+                v[l + lanes] = map((std::uint32_t)words[l]);
+            }
+            std::memcpy(out, v, n * sizeof(int));
+        }
+    }
+
+    // n fair random bits, packed 64 to a word (bit i is bit i%64 of out[i/64]).
+    // Unused bits of the last word are cleared.
+    void fillBits(std::uint64_t* out, std::size_t n) {
+        const std::size_t words = (n + 63) / 64;
+        fill(out, words);
+        if(n % 64) out[words - 1] &= (1ULL << (n % 64)) - 1;
+    }
+
+    static double toDouble(std::uint64_t x) {
+        std::uint64_t bits = (x >> 12) | 0x3ff0000000000000ULL;
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d - 1.0;
+    }
+
+    // 'mantissa' holds 23 random bits
+    static float toFloat(std::uint32_t mantissa) {
+        std::uint32_t bits = (mantissa & 0x7fffff) | 0x3f800000u;
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f - 1.0f;
+    }
+
+protected:
+    static std::uint64_t rotl(std::uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    std::uint64_t stepScalar(int l) {
+        const std::uint64_t result = s[0][l] + s[3][l];
+        const std::uint64_t t = s[1][l] << 17;
+        s[2][l] ^= s[0][l];
+        s[3][l] ^= s[1][l];
+        s[1][l] ^= s[2][l];
+        s[0][l] ^= s[3][l];
+        s[2][l] ^= t;
+        s[3][l] = rotl(s[3][l], 45);
+        return result;
+    }
+
+#if defined(__AVX512F__)
+    __m512i step512(int l) {
+        __m512i s0 = _mm512_loadu_si512((const void*)(s[0] + l)), s1 = _mm512_loadu_si512((const void*)(s[1] + l));
+        __m512i s2 = _mm512_loadu_si512((const void*)(s[2] + l)), s3 = _mm512_loadu_si512((const void*)(s[3] + l));
+        const __m512i result = _mm512_add_epi64(s0, s3);
+        const __m512i t = _mm512_slli_epi64(s1, 17);
+        s2 = _mm512_xor_si512(s2, s0);
+        s3 = _mm512_xor_si512(s3, s1);
+        s1 = _mm512_xor_si512(s1, s2);
+        s0 = _mm512_xor_si512(s0, s3);
+        s2 = _mm512_xor_si512(s2, t);
+        s3 = _mm512_rol_epi64(s3, 45);
+        _mm512_storeu_si512((void*)(s[0] + l), s0); _mm512_storeu_si512((void*)(s[1] + l), s1);
+        _mm512_storeu_si512((void*)(s[2] + l), s2); _mm512_storeu_si512((void*)(s[3] + l), s3);
+        return result;
+    }
+#endif
+
+#if defined(__AVX2__)
+    __m256i step256(int l) {
+        __m256i s0 = _mm256_loadu_si256((const __m256i*)(s[0] + l)), s1 = _mm256_loadu_si256((const __m256i*)(s[1] + l));
+        __m256i s2 = _mm256_loadu_si256((const __m256i*)(s[2] + l)), s3 = _mm256_loadu_si256((const __m256i*)(s[3] + l));
+        const __m256i result = _mm256_add_epi64(s0, s3);
+        const __m256i t = _mm256_slli_epi64(s1, 17);
+        s2 = _mm256_xor_si256(s2, s0);
+        s3 = _mm256_xor_si256(s3, s1);
+        s1 = _mm256_xor_si256(s1, s2);
+        s0 = _mm256_xor_si256(s0, s3);
+        s2 = _mm256_xor_si256(s2, t);
+        s3 = _mm256_or_si256(_mm256_slli_epi64(s3, 45), _mm256_srli_epi64(s3, 19));
+        _mm256_storeu_si256((__m256i*)(s[0] + l), s0); _mm256_storeu_si256((__m256i*)(s[1] + l), s1);
+        _mm256_storeu_si256((__m256i*)(s[2] + l), s2); _mm256_storeu_si256((__m256i*)(s[3] + l), s3);
+        return result;
+    }
+#endif
+
+    alignas(64) std::uint64_t s[4][lanes];
+};
+
+#endif // SIMD_RNG_H
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <cstring>
 #include <cassert>
+#include <cstdio>
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -19,6 +20,8 @@
 #endif
 
 constexpr int NET_MAX_ADDR = 68;
+// Datagrams per recvmmsg/sendmmsg call; larger batches take several calls
+constexpr int NET_MAX_BATCH = 64;
 
 struct Address {
     enum class Type : uint8_t {
@@ -44,12 +47,18 @@ public:
     // (use 0 to select a random open port)
     //
     // Socket will not block if 'non-blocking' is non-zero
-    UDPSocket(Address address, bool non_blocking, int address_family);
-    UDPSocket(uint16_t port, bool non_blocking, int address_family);
+    //
+    // With 'reuse_port', several sockets may bind the same port and the
+    // system spreads the incoming datagrams over them (SO_REUSEPORT)
+    UDPSocket(Address address, bool non_blocking, int address_family, bool reuse_port = false);
+    UDPSocket(uint16_t port, bool non_blocking, int address_family, bool reuse_port = false);
 
     //Closes the opened socket
     ~UDPSocket();
 
+    UDPSocket(const UDPSocket&) = delete;
+    UDPSocket& operator=(const UDPSocket&) = delete;
+
     // Receives a specific amount of data from 'src'
     // If src is not null, src will contain its address and port.
     // Returns the number of bytes received
@@ -59,8 +68,22 @@ public:
     // Returns number of bytes sent.
     int send(const void* data, size_t size, Address dst);
 
+    // Receives up to 'count' datagrams, NET_MAX_BATCH per syscall on Linux
+    // (recvmmsg) and one recvfrom each elsewhere. Datagram i is written to
+    // buffers[i], which holds 'size' bytes, its length to sizes[i] and, if
+    // src is not null, its address to src[i]. A blocking socket waits for
+    // the first datagram only.
+    // Returns the number of datagrams received.
+    int receiveBatch(void* const* buffers, size_t size, size_t* sizes, Address* src, int count);
+
+    // Sends sizes[i] bytes of buffers[i] to dst[i] for i < count, NET_MAX_BATCH
+    // per syscall on Linux (sendmmsg).
+    // Returns the number of datagrams sent.
+    int sendBatch(const void* const* buffers, const size_t* sizes, const Address* dst, int count);
 
     Address getSocket() const { return socket_; }
+    // The OS socket, e.g. to register it with a NetReactor
+    uint64_t getHandle() const { return socket_handle_; }
 
 private:
     Address socket_;
@@ -69,7 +92,54 @@ private:
     uint64_t socket_handle_ = 0;
 };
 
-UDPSocket::UDPSocket(Address address, bool non_blocking, int address_family) : socket_(address), is_blocking_(!non_blocking) {
+namespace net_detail {
+
+inline void toAddress(const sockaddr_storage& from, Address* src) {
+    if (from.ss_family == AF_INET6) {
+        src->type = Address::Type::IPv6;
+        const sockaddr_in6* ipv6 = (const sockaddr_in6*)(&from);
+        memcpy(src->ipv6, &ipv6->sin6_addr, sizeof(ipv6->sin6_addr));
+        src->scope_id = ipv6->sin6_scope_id;
+        src->port = ipv6->sin6_port;
+    }
+    else {
+        src->type = Address::Type::IPv4;
+        const sockaddr_in* ipv4 = (const sockaddr_in*)(&from);
+        src->ipv4 = ipv4->sin_addr.s_addr;
+        src->scope_id = 0;
+        src->port = ipv4->sin_port;
+    }
+}
+
+// Fills 'address' from 'dst' and returns its length, 0 for an invalid type
+inline size_t toSockaddr(const Address& dst, sockaddr_storage& address) {
+    memset(&address, 0, sizeof(address));
+    switch (dst.type) {
+        case Address::Type::IPv4:
+        {
+            sockaddr_in* ipv4 = (sockaddr_in*)(&address);
+            ipv4->sin_family = AF_INET;
+            ipv4->sin_port = dst.port;
+            ipv4->sin_addr.s_addr = dst.ipv4;
+            return sizeof(sockaddr_in);
+        }
+        case Address::Type::IPv6:
+        {
+            sockaddr_in6* ipv6 = (sockaddr_in6*)(&address);
+            ipv6->sin6_family = AF_INET6;
+            ipv6->sin6_port = dst.port;
+            ipv6->sin6_scope_id = dst.scope_id;
+            memcpy(&ipv6->sin6_addr, &dst.ipv6, sizeof(ipv6->sin6_addr));
+            return sizeof(sockaddr_in6);
+        }
+        default:
+            return 0;
+    }
+}
+
+} // namespace net_detail
+
+inline UDPSocket::UDPSocket(Address address, bool non_blocking, int address_family, bool reuse_port) : socket_(address), is_blocking_(!non_blocking) {
 #ifdef _WIN32
     WSADATA wsa_data;
     if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != NO_ERROR) {
@@ -86,6 +156,19 @@ UDPSocket::UDPSocket(Address address, bool non_blocking, int address_family) : s
         assert(false);
     }
 
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+        int opt = 1;
+        if (setsockopt(socket_handle_, SOL_SOCKET, SO_REUSEPORT, (const char*)&opt, sizeof(opt)) != 0) {
+            printf("Failed to set SO_REUSEPORT\n");
+            assert(false);
+        }
+#else
+        printf("SO_REUSEPORT is not supported\n");
+        assert(false);
+#endif
+    }
+
     // Bind socket to the port
     {
         addrinfo hints;
@@ -136,7 +219,7 @@ UDPSocket::UDPSocket(Address address, bool non_blocking, int address_family) : s
         DWORD non_blocking = 1;
         if (ioctlsocket(socket_handle_, FIONBIO, &non_blocking) != 0) {
             // Failed to set port to non-blocking
-            printf(""Failed to set socket to non-blocking\n");
+            printf("Failed to set socket to non-blocking\n");
             assert(false);
         }
 #else
@@ -150,18 +233,23 @@ UDPSocket::UDPSocket(Address address, bool non_blocking, int address_family) : s
     }
 }
 
-UDPSocket::UDPSocket(uint16_t port, bool non_blocking, int address_family)
-    : UDPSocket({{0}, port, 0, Address::Type::count}, non_blocking, address_family)
+inline UDPSocket::UDPSocket(uint16_t port, bool non_blocking, int address_family, bool reuse_port)
+    : UDPSocket({{0}, port, 0, Address::Type::count}, non_blocking, address_family, reuse_port)
 {
 }
 
-UDPSocket::~UDPSocket() {
+inline UDPSocket::~UDPSocket() {
 #ifdef _WIN32
+    closesocket(socket_handle_);
     WSACleanup();
+#else
+    // a socket left open in a SO_REUSEPORT group would keep taking its
+    // share of the datagrams
+    close(int(socket_handle_));
 #endif
 }
 
-int UDPSocket::receive(void* data, size_t size, Address* src) {
+inline int UDPSocket::receive(void* data, size_t size, Address* src) {
 #ifdef _WIN32
     typedef int32_t socklen_t;
 #endif
@@ -169,69 +257,20 @@ int UDPSocket::receive(void* data, size_t size, Address* src) {
     sockaddr_storage from;
     socklen_t from_length = sizeof(sockaddr_storage);
 
-    int32_t received_bytes = 0;
-    if (socket_handle_)
-        received_bytes = recvfrom(socket_handle_, (char*)data, size, 0,
-                                  (sockaddr*)&from, &from_length);
-
-    //still not received anything, check if ipv6 address has something
-    if (received_bytes <= 0) {
-        if (socket_handle_) {
-            received_bytes = recvfrom(socket_handle_, (char*)data, size, 0,
-                                      (sockaddr*)&from, &from_length);
-            if (received_bytes <= 0) return 0;
-        }
-        else return 0;
-    }
+    if (!socket_handle_) return 0;
+    const int32_t received_bytes = recvfrom(socket_handle_, (char*)data, size, 0,
+                                            (sockaddr*)&from, &from_length);
+    if (received_bytes <= 0) return 0;
 
-    if(src) {
-        if (from.ss_family == AF_INET6) {
-            src->type = Address::Type::IPv6;
-            const sockaddr_in6* ipv6 = (const sockaddr_in6*)(&from);
-            memcpy(src->ipv6, &ipv6->sin6_addr, sizeof(ipv6->sin6_addr));
-            src->scope_id = ipv6->sin6_scope_id;
-            src->port = ipv6->sin6_port;
-        }
-        else {
-            src->type = Address::Type::IPv4;
-            const sockaddr_in* ipv4 = (const sockaddr_in*)(&from);
-            src->ipv4 = ipv4->sin_addr.s_addr;
-            src->scope_id = 0;
-            src->port = ipv4->sin_port;
-        }
-    }
+    if(src) net_detail::toAddress(from, src);
 
     return received_bytes;
 }
 
-int UDPSocket::send(const void* data, size_t size, Address dst) {
+inline int UDPSocket::send(const void* data, size_t size, Address dst) {
     sockaddr_storage address;
-    memset(&address, 0, sizeof(address));
-    size_t addr_length = 0;
-    switch (dst.type) {
-        case Address::Type::IPv4:
-        {
-            sockaddr_in* ipv4 = (sockaddr_in*)(&address);
-            ipv4->sin_family = AF_INET;
-            ipv4->sin_port = dst.port;
-            ipv4->sin_addr.s_addr = dst.ipv4;
-            addr_length = sizeof(sockaddr_in);
-            break;
-        }
-        case Address::Type::IPv6:
-        {
-            sockaddr_in6* ipv6 = (sockaddr_in6*)(&address);
-            ipv6->sin6_family = AF_INET6;
-            ipv6->sin6_port = dst.port;
-            ipv6->sin6_scope_id = dst.scope_id;
-            memcpy(&ipv6->sin6_addr, &dst.ipv6, sizeof(ipv6->sin6_addr));
-            addr_length = sizeof(sockaddr_in6);
-            break;
-        }
-        default:
-            return 0;
-            break;
-    }
+    const size_t addr_length = net_detail::toSockaddr(dst, address);
+    if (!addr_length) return 0;
 
     size_t sent_bytes = 0;
     // do we actually have a socket open for the desired protocol?
@@ -247,5 +286,98 @@ int UDPSocket::send(const void* data, size_t size, Address dst) {
     return sent_bytes;
 }
 
+#ifdef __linux__
+inline int UDPSocket::receiveBatch(void* const* buffers, size_t size, size_t* sizes, Address* src, int count) {
+    if (!socket_handle_) return 0;
+
+    mmsghdr messages[NET_MAX_BATCH];
+    iovec iovecs[NET_MAX_BATCH];
+    sockaddr_storage from[NET_MAX_BATCH];
+
+    int received = 0;
+    while (received < count) {
+        const int batch = count - received < NET_MAX_BATCH ? count - received : NET_MAX_BATCH;
+        memset(messages, 0, sizeof(mmsghdr) * batch);
+        for (int i = 0; i < batch; ++i) {
+            iovecs[i].iov_base = buffers[received + i];
+            iovecs[i].iov_len = size;
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            if (src) {
+                messages[i].msg_hdr.msg_name = &from[i];
+                messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            }
+        }
+
+        // only the first call may block, and only until one datagram is in
+        const int flags = received ? MSG_DONTWAIT : MSG_WAITFORONE;
+        const int n = recvmmsg(socket_handle_, messages, batch, flags, nullptr);
+        if (n <= 0) break;
+
+        for (int i = 0; i < n; ++i) {
+            sizes[received + i] = messages[i].msg_len;
+            if (src) net_detail::toAddress(from[i], &src[received + i]);
+        }
+        received += n;
+        if (n < batch) break; // the queue is empty
+    }
+    return received;
+}
+
+inline int UDPSocket::sendBatch(const void* const* buffers, const size_t* sizes, const Address* dst, int count) {
+    if (!socket_handle_) return 0;
+
+    mmsghdr messages[NET_MAX_BATCH];
+    iovec iovecs[NET_MAX_BATCH];
+    sockaddr_storage to[NET_MAX_BATCH];
+
+    int sent = 0;
+    while (sent < count) {
+        const int batch = count - sent < NET_MAX_BATCH ? count - sent : NET_MAX_BATCH;
+        memset(messages, 0, sizeof(mmsghdr) * batch);
+        for (int i = 0; i < batch; ++i) {
+            const size_t addr_length = net_detail::toSockaddr(dst[sent + i], to[i]);
+            if (!addr_length) {
+                printf("Invalid address type\n");
+                return sent;
+            }
+            iovecs[i].iov_base = const_cast<void*>(buffers[sent + i]);
+            iovecs[i].iov_len = sizes[sent + i];
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = &to[i];
+            messages[i].msg_hdr.msg_namelen = socklen_t(addr_length);
+        }
+
+        const int n = sendmmsg(socket_handle_, messages, batch, 0);
+        if (n <= 0) {
+            printf("Failed to send data\n");
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+#else
+inline int UDPSocket::receiveBatch(void* const* buffers, size_t size, size_t* sizes, Address* src, int count) {
+    int received = 0;
+    for (; received < count; ++received) {
+        const int bytes = receive(buffers[received], size, src ? &src[received] : nullptr);
+        if (bytes <= 0) break;
+        sizes[received] = size_t(bytes);
+        // like recvmmsg, only wait for the first one
+        if (is_blocking_) break;
+    }
+    return received;
+}
+
+inline int UDPSocket::sendBatch(const void* const* buffers, const size_t* sizes, const Address* dst, int count) {
+    int sent = 0;
+    for (; sent < count; ++sent)
+        if (send(buffers[sent], sizes[sent], dst[sent]) <= 0) break;
+    return sent;
+}
+#endif
+
 #endif // NET_H
 
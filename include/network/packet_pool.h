@@ -0,0 +1,295 @@
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include "net.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <new>
+#include <utility>
+#include <vector>
+
+constexpr size_t NET_CACHE_LINE = 64;
+
+class PacketPool;
+
+// Fixed pool of packet buffers that receives write into directly. A
+// PacketRef shares one packet: copies add a reference, and the last one to
+// go returns the buffer to the pool, from whichever thread that happens on.
+//
+//     PacketPool pool(4096);
+//     PacketRef packets[NET_MAX_BATCH];
+//     const int n = pool.receive(socket, packets, NET_MAX_BATCH);
+//     for (int i = 0; i < n; ++i) queue.push(std::move(packets[i]));
+//
+// The pool has to outlive every PacketRef taken from it.
+class PacketRef {
+public:
+    PacketRef() = default;
+    PacketRef(const PacketRef& other);
+    PacketRef(PacketRef&& other) : slot_(other.slot_) { other.slot_ = nullptr; }
+    PacketRef& operator=(PacketRef other) { std::swap(slot_, other.slot_); return *this; }
+    ~PacketRef() { reset(); }
+
+    // Drops this reference
+    void reset();
+
+    explicit operator bool() const { return slot_ != nullptr; }
+
+    char* data() const;
+    size_t size() const;
+    // Bytes data() can hold
+    size_t capacity() const;
+    void setSize(size_t size);
+
+    // Sender of a received packet, destination of one being sent
+    Address& address() const;
+    // steady_clock nanoseconds at which the packet was received
+    uint64_t timestamp() const;
+    void setTimestamp(uint64_t timestamp);
+
+    uint32_t useCount() const;
+
+private:
+    friend class PacketPool;
+    struct Slot;
+
+    explicit PacketRef(Slot* slot) : slot_(slot) {}
+
+    Slot* slot_ = nullptr;
+};
+
+// Header in front of each packet's payload; the payload starts on the
+// next cache line
+struct alignas(NET_CACHE_LINE) PacketRef::Slot {
+    std::atomic<uint32_t> refs;
+    // free-list link, atomic since a popping thread may read it while the
+    // packet is taken and returned by others
+    std::atomic<uint32_t> next;
+    uint32_t index;
+    uint32_t size;
+    uint64_t timestamp;
+    PacketPool* pool;
+    Address address;
+};
+
+class PacketPool {
+public:
+    struct Stats {
+        size_t capacity;    // packets in the pool
+        size_t in_use;      // packets held by PacketRefs
+        size_t peak;        // highest in_use so far
+        uint64_t exhausted; // acquire() calls that found the pool empty
+    };
+
+    // 'count' packets of 'packet_size' bytes each
+    PacketPool(size_t count, size_t packet_size = 2048);
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    // A packet with size() 0, or an empty PacketRef if all are in use.
+    // Lock-free; safe from any thread.
+    PacketRef acquire();
+
+    // Receives up to 'count' datagrams from 'socket' with receiveBatch()
+    // straight into pooled packets, stamped with the time of the call.
+    // Returns the number received; packets[0..n) hold them. Receives no
+    // more than the pool has free.
+    int receive(UDPSocket& socket, PacketRef* packets, int count);
+
+    // Sends packets[i] to its address() for i < count with sendBatch().
+    // Returns the number of datagrams sent.
+    int send(UDPSocket& socket, const PacketRef* packets, int count);
+
+    size_t packetSize() const { return packet_size_; }
+
+    // A snapshot; other threads may change the counts while it is taken
+    Stats stats() const;
+
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    friend class PacketRef;
+    using Slot = PacketRef::Slot;
+
+    // index of an empty free list
+    static constexpr uint32_t END = UINT32_MAX;
+
+    Slot* slot(uint32_t index) const { return (Slot*)(base_ + size_t(index) * stride_); }
+    void release(Slot* slot);
+
+    std::vector<char> memory_;
+    char* base_ = nullptr;
+    size_t stride_ = 0;
+    size_t packet_size_ = 0;
+    size_t count_ = 0;
+
+    // Free list head: a change count in the high half, so that a thread
+    // holding a stale head cannot swap it in after others popped and pushed
+    // the same packet (ABA), and the first free index in the low half.
+    // Padded apart from each other and the fields read on every access,
+    // as the handles contend on them. Padding rather than alignas, which
+    // C++14's operator new does not honour for pools on the heap.
+    char pad0_[NET_CACHE_LINE];
+    std::atomic<uint64_t> head_{END};
+    char pad1_[NET_CACHE_LINE];
+    std::atomic<size_t> in_use_{0};
+    std::atomic<size_t> peak_{0};
+    std::atomic<uint64_t> exhausted_{0};
+    char pad2_[NET_CACHE_LINE];
+};
+
+inline PacketRef::PacketRef(const PacketRef& other) : slot_(other.slot_) {
+    if (slot_) slot_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void PacketRef::reset() {
+    if (!slot_) return;
+    // the last reference sees every write made through the others
+    if (slot_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) slot_->pool->release(slot_);
+    slot_ = nullptr;
+}
+
+inline char* PacketRef::data() const { return (char*)slot_ + sizeof(Slot); }
+inline size_t PacketRef::size() const { return slot_->size; }
+inline size_t PacketRef::capacity() const { return slot_->pool->packet_size_; }
+inline Address& PacketRef::address() const { return slot_->address; }
+inline uint64_t PacketRef::timestamp() const { return slot_->timestamp; }
+inline void PacketRef::setTimestamp(uint64_t timestamp) { slot_->timestamp = timestamp; }
+inline uint32_t PacketRef::useCount() const { return slot_ ? slot_->refs.load(std::memory_order_relaxed) : 0; }
+
+inline void PacketRef::setSize(size_t size) {
+    assert(size <= capacity());
+    slot_->size = uint32_t(size);
+}
+
+inline PacketPool::PacketPool(size_t count, size_t packet_size) : packet_size_(packet_size), count_(count) {
+    if (count == 0 || count >= END || packet_size > UINT32_MAX) {
+        printf("Invalid packet pool size\n");
+        assert(false);
+        count_ = 0;
+        return;
+    }
+
+    // payloads padded to whole cache lines so neighbours never share one
+    stride_ = sizeof(Slot) + (packet_size + NET_CACHE_LINE - 1) / NET_CACHE_LINE * NET_CACHE_LINE;
+    memory_.resize(stride_ * count + NET_CACHE_LINE);
+    base_ = memory_.data() + (NET_CACHE_LINE - uintptr_t(memory_.data()) % NET_CACHE_LINE) % NET_CACHE_LINE;
+
+    for (size_t i = 0; i < count; ++i) {
+        Slot* s = new (base_ + i * stride_) Slot();
+        s->refs.store(0, std::memory_order_relaxed);
+        s->next.store(i + 1 < count ? uint32_t(i + 1) : END, std::memory_order_relaxed);
+        s->index = uint32_t(i);
+        s->pool = this;
+    }
+    head_.store(0, std::memory_order_release);
+}
+
+inline PacketPool::~PacketPool() {
+    // PacketRefs still out would point into freed memory
+    assert(in_use_.load() == 0);
+    for (size_t i = 0; i < count_; ++i) slot(uint32_t(i))->~Slot();
+}
+
+inline PacketRef PacketPool::acquire() {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    for (;;) {
+        const uint32_t index = uint32_t(head);
+        if (index == END) {
+            exhausted_.fetch_add(1, std::memory_order_relaxed);
+            return PacketRef();
+        }
+        const uint64_t next = ((head >> 32) + 1) << 32 | slot(index)->next.load(std::memory_order_relaxed);
+        if (head_.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) break;
+    }
+
+    const size_t used = in_use_.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t peak = peak_.load(std::memory_order_relaxed);
+    while (used > peak && !peak_.compare_exchange_weak(peak, used, std::memory_order_relaxed)) {}
+
+    Slot* s = slot(uint32_t(head));
+    s->refs.store(1, std::memory_order_relaxed);
+    s->size = 0;
+    s->timestamp = 0;
+    return PacketRef(s);
+}
+
+inline void PacketPool::release(Slot* s) {
+    in_use_.fetch_sub(1, std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        s->next.store(uint32_t(head), std::memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | s->index;
+    } while (!head_.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+inline int PacketPool::receive(UDPSocket& socket, PacketRef* packets, int count) {
+    void* buffers[NET_MAX_BATCH];
+    size_t sizes[NET_MAX_BATCH];
+    Address sources[NET_MAX_BATCH];
+
+    int received = 0;
+    while (received < count) {
+        const int want = count - received < NET_MAX_BATCH ? count - received : NET_MAX_BATCH;
+        int batch = 0;
+        for (; batch < want; ++batch) {
+            packets[received + batch] = acquire();
+            if (!packets[received + batch]) break;
+            buffers[batch] = packets[received + batch].data();
+        }
+        if (batch == 0) break;
+
+        const int n = socket.receiveBatch(buffers, packet_size_, sizes, sources, batch);
+        const uint64_t time = now();
+        for (int i = 0; i < n; ++i) {
+            PacketRef& packet = packets[received + i];
+            packet.setSize(sizes[i]);
+            packet.setTimestamp(time);
+            packet.address() = sources[i];
+        }
+        // the packets that got nothing go back
+        for (int i = n; i < batch; ++i) packets[received + i].reset();
+        received += n;
+        if (n < batch) break;
+    }
+    return received;
+}
+
+inline int PacketPool::send(UDPSocket& socket, const PacketRef* packets, int count) {
+    const void* buffers[NET_MAX_BATCH];
+    size_t sizes[NET_MAX_BATCH];
+    Address targets[NET_MAX_BATCH];
+
+    int sent = 0;
+    while (sent < count) {
+        const int batch = count - sent < NET_MAX_BATCH ? count - sent : NET_MAX_BATCH;
+        for (int i = 0; i < batch; ++i) {
+            buffers[i] = packets[sent + i].data();
+            sizes[i] = packets[sent + i].size();
+            targets[i] = packets[sent + i].address();
+        }
+        const int n = socket.sendBatch(buffers, sizes, targets, batch);
+        sent += n;
+        if (n < batch) break;
+    }
+    return sent;
+}
+
+inline PacketPool::Stats PacketPool::stats() const {
+    Stats stats;
+    stats.capacity = count_;
+    stats.in_use = in_use_.load(std::memory_order_relaxed);
+    stats.peak = peak_.load(std::memory_order_relaxed);
+    stats.exhausted = exhausted_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+#endif // PACKET_POOL_H
@@ -0,0 +1,298 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "net.h"
+
+#ifdef __linux__
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// epoll_wait results per call
+constexpr int NET_MAX_EVENTS = 256;
+
+// Single-threaded event loop over any number of UDPSockets (Linux, epoll).
+// Readiness is dispatched to a callback per socket, and timers run on the
+// same thread, so one thread serves thousands of sockets without polling
+// each one:
+//
+//     NetReactor reactor;
+//     reactor.add(socket, NetReactor::Readable, [&](UDPSocket& s, uint32_t events) {
+//         NetReactor::drain(s, buffers, 2048, sizes, sources, NET_MAX_BATCH, [&](int n) { ... });
+//     });
+//     reactor.addTimer(1000, 1000, [] { printf("tick\n"); });
+//     reactor.run();
+//
+// Sockets are edge-triggered by default: a callback then has to read (or
+// write) until the socket would block, which drain() does for reads, or it
+// is not called again for the data left over. Edge-triggered sockets must
+// be non-blocking.
+class NetReactor {
+public:
+    enum Event : uint32_t {
+        Readable = 1,
+        Writable = 2,
+        Error    = 4, // also reported when the socket has an error pending
+    };
+
+    using Callback = std::function<void(UDPSocket& socket, uint32_t events)>;
+    using TimerId = uint64_t;
+
+    NetReactor();
+    ~NetReactor();
+
+    NetReactor(const NetReactor&) = delete;
+    NetReactor& operator=(const NetReactor&) = delete;
+
+    // Calls 'callback' with the Event bits of 'events' that are ready. The
+    // socket must outlive its registration.
+    // Returns false if epoll refused the socket.
+    bool add(UDPSocket& socket, uint32_t events, Callback callback, bool edge_triggered = true);
+
+    // Changes the events watched for a registered socket
+    bool modify(UDPSocket& socket, uint32_t events);
+
+    // Callbacks may remove any socket, including their own
+    void remove(UDPSocket& socket);
+
+    // Runs 'callback' after 'delay_ms', then every 'interval_ms' if that is
+    // not 0, until cancelled. Timers fire from poll().
+    TimerId addTimer(int64_t delay_ms, int64_t interval_ms, std::function<void()> callback);
+
+    // Returns false if the timer already ran out or was cancelled
+    bool cancelTimer(TimerId id);
+
+    // Waits up to 'timeout_ms' (-1: no limit) for readiness or the next
+    // timer, then dispatches everything that is due.
+    // Returns the number of callbacks run.
+    int poll(int timeout_ms = -1);
+
+    // poll() until stop()
+    void run();
+
+    // Makes run() return; may be called from any thread. A stop() before
+    // run() makes the next run() return at once.
+    void stop();
+
+    // Receives batches from 'socket' until it is empty, calling
+    // handler(received) after each with the datagrams in buffers[0..received).
+    // Returns the number of datagrams received.
+    template<typename Handler>
+    static int drain(UDPSocket& socket, void* const* buffers, size_t size, size_t* sizes, Address* src,
+                     int count, const Handler& handler);
+
+private:
+    struct Entry {
+        UDPSocket* socket;
+        Callback callback;
+        bool edge_triggered;
+    };
+
+    struct Timer {
+        std::function<void()> callback;
+        int64_t interval_ms;
+    };
+
+    // (deadline, id), earliest first
+    using Deadline = std::pair<int64_t, TimerId>;
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint32_t toEpoll(uint32_t events, bool edge_triggered);
+    int runTimers();
+
+    int epoll_ = -1;
+    int wake_ = -1; // eventfd that stop() writes to
+    std::atomic<bool> stopped_{false};
+
+    std::unordered_map<int, std::unique_ptr<Entry>> entries_;
+    // removed during dispatch; freed once the callbacks have returned
+    std::vector<std::unique_ptr<Entry>> removed_;
+
+    std::unordered_map<TimerId, Timer> timers_;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines_;
+    TimerId next_timer_ = 1;
+};
+
+inline NetReactor::NetReactor() {
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_ < 0 || wake_ < 0) {
+        printf("Failed to create epoll instance\n");
+        assert(false);
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &ev);
+}
+
+inline NetReactor::~NetReactor() {
+    if (wake_ >= 0) close(wake_);
+    if (epoll_ >= 0) close(epoll_);
+}
+
+inline uint32_t NetReactor::toEpoll(uint32_t events, bool edge_triggered) {
+    uint32_t result = 0;
+    if (events & Readable) result |= EPOLLIN;
+    if (events & Writable) result |= EPOLLOUT;
+    if (edge_triggered) result |= EPOLLET;
+    return result;
+}
+
+inline bool NetReactor::add(UDPSocket& socket, uint32_t events, Callback callback, bool edge_triggered) {
+    const int fd = int(socket.getHandle());
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = toEpoll(events, edge_triggered);
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        printf("Failed to add socket to epoll\n");
+        return false;
+    }
+
+    entries_[fd].reset(new Entry{&socket, std::move(callback), edge_triggered});
+    return true;
+}
+
+inline bool NetReactor::modify(UDPSocket& socket, uint32_t events) {
+    const int fd = int(socket.getHandle());
+    auto it = entries_.find(fd);
+    if (it == entries_.end()) return false;
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = toEpoll(events, it->second->edge_triggered);
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+inline void NetReactor::remove(UDPSocket& socket) {
+    const int fd = int(socket.getHandle());
+    auto it = entries_.find(fd);
+    if (it == entries_.end()) return;
+
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+    removed_.push_back(std::move(it->second));
+    entries_.erase(it);
+}
+
+inline NetReactor::TimerId NetReactor::addTimer(int64_t delay_ms, int64_t interval_ms, std::function<void()> callback) {
+    const TimerId id = next_timer_++;
+    timers_[id] = Timer{std::move(callback), interval_ms};
+    deadlines_.push(Deadline(now() + delay_ms, id));
+    return id;
+}
+
+inline bool NetReactor::cancelTimer(TimerId id) {
+    // its deadline stays queued and is skipped when it comes up
+    return timers_.erase(id) != 0;
+}
+
+inline int NetReactor::runTimers() {
+    int ran = 0;
+    const int64_t time = now();
+    while (!deadlines_.empty() && deadlines_.top().first <= time) {
+        const Deadline due = deadlines_.top();
+        deadlines_.pop();
+        auto it = timers_.find(due.second);
+        if (it == timers_.end()) continue; // cancelled
+
+        // the callback may add or cancel timers, itself included
+        std::function<void()> callback = std::move(it->second.callback);
+        const int64_t interval = it->second.interval_ms;
+        if (!interval) timers_.erase(it);
+        callback();
+        ++ran;
+
+        if (interval) {
+            it = timers_.find(due.second);
+            if (it == timers_.end()) continue;
+            it->second.callback = std::move(callback);
+            // a reactor that fell behind skips the missed periods
+            const int64_t next = due.first + interval;
+            deadlines_.push(Deadline(next > time ? next : time + interval, due.second));
+        }
+    }
+    return ran;
+}
+
+inline int NetReactor::poll(int timeout_ms) {
+    if (!deadlines_.empty()) {
+        const int64_t wait = deadlines_.top().first - now();
+        const int until_timer = wait > 0 ? int(wait) : 0;
+        if (timeout_ms < 0 || until_timer < timeout_ms) timeout_ms = until_timer;
+    }
+
+    epoll_event events[NET_MAX_EVENTS];
+    const int n = epoll_wait(epoll_, events, NET_MAX_EVENTS, timeout_ms);
+
+    int ran = 0;
+    for (int i = 0; i < n; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == wake_) {
+            uint64_t value;
+            while (read(wake_, &value, sizeof(value)) > 0) {}
+            continue;
+        }
+        auto it = entries_.find(fd);
+        if (it == entries_.end()) continue; // removed by an earlier callback
+
+        uint32_t ready = 0;
+        if (events[i].events & (EPOLLIN | EPOLLHUP)) ready |= Readable;
+        if (events[i].events & EPOLLOUT) ready |= Writable;
+        if (events[i].events & EPOLLERR) ready |= Error;
+        Entry& entry = *it->second;
+        entry.callback(*entry.socket, ready);
+        ++ran;
+    }
+    removed_.clear();
+
+    return ran + runTimers();
+}
+
+inline void NetReactor::run() {
+    while (!stopped_) poll();
+    // cleared here rather than on entry, which would lose an early stop()
+    stopped_ = false;
+}
+
+inline void NetReactor::stop() {
+    stopped_ = true;
+    const uint64_t one = 1;
+    if (write(wake_, &one, sizeof(one)) < 0) {
+        // the counter is already non-zero, so the loop wakes up anyway
+    }
+}
+
+template<typename Handler>
+int NetReactor::drain(UDPSocket& socket, void* const* buffers, size_t size, size_t* sizes, Address* src,
+                      int count, const Handler& handler) {
+    int total = 0;
+    for (;;) {
+        const int received = socket.receiveBatch(buffers, size, sizes, src, count);
+        if (received > 0) {
+            handler(received);
+            total += received;
+        }
+        // a short batch means the queue was empty
+        if (received < count) return total;
+    }
+}
+
+#endif // __linux__
+
+#endif // REACTOR_H
@@ -0,0 +1,223 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "packet_pool.h"
+#include "reactor.h"
+
+#ifdef __linux__
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Full receive batches a worker handles per wake-up before it polls again
+constexpr int NET_SERVER_BATCHES = 16;
+
+// Receives on one port with a socket and a thread per worker. The sockets
+// share the port through SO_REUSEPORT, so the kernel spreads the datagrams
+// over them, and each worker runs its own NetReactor and PacketPool on its
+// own core (Linux):
+//
+//     UDPServer server(4000, AF_INET);
+//     server.start([](unsigned worker, UDPSocket& socket, PacketRef* packets, int count) {
+//         for (int i = 0; i < count; ++i) socket.send(packets[i].data(), packets[i].size(), packets[i].address());
+//     });
+//     ...
+//     server.stop();
+//
+// Worker i runs on the i-th core the process may use (sched_getaffinity, so
+// taskset and cpusets are followed), wrapping around when there are more
+// workers than cores. With CPU steering a BPF program sends each datagram
+// to the socket of the worker on the core that received it from the
+// network, so a flow is read where the interrupt landed; datagrams received
+// on a core without a worker go by core number modulo the workers. Without
+// steering the kernel picks sockets by flow hash.
+class UDPServer {
+public:
+    // Called on the worker's thread with the batch packets[0..count). The
+    // packets may be kept or handed to other threads; 'socket' is the
+    // worker's, for replies.
+    using Handler = std::function<void(unsigned worker, UDPSocket& socket, PacketRef* packets, int count)>;
+
+    // Binds 'workers' sockets (0: one per usable core) to 'port'. 'packets'
+    // is the size of each worker's pool, 'packet_size' that of its packets.
+    UDPServer(uint16_t port, int address_family, unsigned workers = 0, bool steer_by_cpu = true,
+              size_t packets = 4096, size_t packet_size = 2048);
+    ~UDPServer();
+
+    UDPServer(const UDPServer&) = delete;
+    UDPServer& operator=(const UDPServer&) = delete;
+
+    // Starts a thread per worker, pinned to cpu(worker)
+    void start(Handler handler);
+
+    // Waits for the workers to finish their current batch
+    void stop();
+
+    unsigned workers() const { return unsigned(workers_.size()); }
+    // The core 'worker' runs on
+    int cpu(unsigned worker) const { return cpus_[worker % cpus_.size()]; }
+    // false if the kernel refused the BPF program and the flow hash is used
+    bool steered() const { return steered_; }
+
+    // Datagrams received by 'worker' so far
+    uint64_t received(unsigned worker) const { return workers_[worker]->received.load(std::memory_order_relaxed); }
+    PacketPool::Stats poolStats(unsigned worker) const { return workers_[worker]->pool.stats(); }
+
+private:
+    struct Worker {
+        Worker(uint16_t port, int address_family, size_t packets, size_t packet_size)
+            : socket(port, true, address_family, true), pool(packets, packet_size) {}
+
+        UDPSocket socket;
+        PacketPool pool;
+        NetReactor reactor;
+        std::thread thread;
+        std::atomic<uint64_t> received{0};
+    };
+
+    bool steerByCpu();
+    void run(unsigned index);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // cores the process may run on, in ascending order
+    std::vector<int> cpus_;
+    Handler handler_;
+    bool steered_ = false;
+    bool running_ = false;
+    // set before the reactors are woken, so a worker that has not started
+    // polling yet still stops
+    std::atomic<bool> stopping_{false};
+};
+
+inline UDPServer::UDPServer(uint16_t port, int address_family, unsigned workers, bool steer_by_cpu,
+                            size_t packets, size_t packet_size) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &allowed)) cpus_.push_back(c);
+    }
+    if (cpus_.empty()) {
+        const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned c = 0; c < cores; ++c) cpus_.push_back(int(c));
+    }
+
+    if (workers == 0) workers = unsigned(cpus_.size());
+    // in bind order, which is the order of the socket group the BPF
+    // program indexes
+    for (unsigned i = 0; i < workers; ++i)
+        workers_.emplace_back(new Worker(port, address_family, packets, packet_size));
+    if (steer_by_cpu) steered_ = steerByCpu();
+}
+
+inline UDPServer::~UDPServer() {
+    stop();
+}
+
+inline bool UDPServer::steerByCpu() {
+    // The program returns the index of a socket in the group:
+    //     A = receiving cpu
+    //     if (A == cpu(k)) return k     for each worker k with a core of its own
+    //     return A % workers
+    // One program serves the whole group.
+    const size_t workers = workers_.size();
+    const size_t mapped = std::min(workers, cpus_.size());
+    if (3 + 2 * mapped > BPF_MAXINSNS) {
+        printf("Too many workers for the CPU steering program, using the flow hash\n");
+        return false;
+    }
+
+    std::vector<sock_filter> code;
+    code.push_back({BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t(SKF_AD_OFF + SKF_AD_CPU)});
+    for (size_t k = 0; k < mapped; ++k) {
+        // skip the return unless A is worker k's core
+        code.push_back({BPF_JMP | BPF_JEQ | BPF_K, 0, 1, uint32_t(cpus_[k])});
+        code.push_back({BPF_RET | BPF_K, 0, 0, uint32_t(k)});
+    }
+    code.push_back({BPF_ALU | BPF_MOD | BPF_K, 0, 0, uint32_t(workers)});
+    code.push_back({BPF_RET | BPF_A, 0, 0, 0});
+
+    sock_fprog program;
+    program.len = (unsigned short)code.size();
+    program.filter = code.data();
+    const int fd = int(workers_[0]->socket.getHandle());
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != 0) {
+        printf("Failed to attach the CPU steering program, using the flow hash\n");
+        return false;
+    }
+    return true;
+}
+
+inline void UDPServer::start(Handler handler) {
+    if (running_) return;
+    running_ = true;
+    stopping_ = false;
+    handler_ = std::move(handler);
+    for (unsigned i = 0; i < workers_.size(); ++i)
+        workers_[i]->thread = std::thread([this, i] { run(i); });
+}
+
+inline void UDPServer::stop() {
+    if (!running_) return;
+    stopping_ = true;
+    for (auto& worker : workers_) worker->reactor.stop();
+    for (auto& worker : workers_) worker->thread.join();
+    running_ = false;
+}
+
+inline void UDPServer::run(unsigned index) {
+    Worker& worker = *workers_[index];
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu(index), &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        printf("Failed to pin worker %u to cpu %d\n", index, cpu(index));
+
+    // Level-triggered, so datagrams left in the socket are read on the next
+    // poll. Each wake-up reads at most NET_SERVER_BATCHES full batches, so
+    // under sustained load the worker still gets back to the reactor for
+    // stop() and its timers. When the handler holds every packet of the pool the socket is
+    // unwatched, rather than reported ready on every poll, and a timer
+    // watches it again once packets come back.
+    const size_t capacity = worker.pool.stats().capacity;
+    bool paused = false;
+    NetReactor::TimerId resume = 0;
+    worker.reactor.add(worker.socket, NetReactor::Readable, [&](UDPSocket& socket, uint32_t) {
+        PacketRef packets[NET_MAX_BATCH];
+        for (int batch = 0; batch < NET_SERVER_BATCHES; ++batch) {
+            const int n = worker.pool.receive(socket, packets, NET_MAX_BATCH);
+            if (n > 0) {
+                worker.received.fetch_add(uint64_t(n), std::memory_order_relaxed);
+                handler_(index, socket, packets, n);
+            }
+            for (auto& packet : packets) packet.reset();
+            if (n == NET_MAX_BATCH) continue;
+
+            if (!paused && worker.pool.stats().in_use >= capacity) {
+                paused = true;
+                worker.reactor.modify(socket, 0);
+                resume = worker.reactor.addTimer(1, 1, [&] {
+                    if (worker.pool.stats().in_use >= capacity) return;
+                    paused = false;
+                    worker.reactor.modify(worker.socket, NetReactor::Readable);
+                    worker.reactor.cancelTimer(resume);
+                });
+            }
+            return;
+        }
+    }, false);
+    while (!stopping_) worker.reactor.poll();
+    worker.reactor.remove(worker.socket);
+}
+
+#endif // __linux__
+
+#endif // SERVER_H
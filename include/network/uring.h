@@ -0,0 +1,477 @@
+#ifndef URING_H
+#define URING_H
+
+#include "net.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// io_uring receive and send path for a UDPSocket, without liburing.
+//
+// Receiving arms one multishot IORING_OP_RECVMSG that draws its buffers from
+// a ring of 'buffers' preallocated buffers registered with the kernel
+// (IORING_REGISTER_PBUF_RING), so each datagram lands in that memory
+// without a syscall of its own. receive() reaps every completion that is
+// ready, hands the datagrams to a handler and gives their buffers back.
+// Sends are copied into a preallocated slab registered with the kernel
+// (IORING_REGISTER_BUFFERS) and queued as IORING_OP_SEND_ZC on that fixed
+// buffer, so the kernel neither maps nor copies the payload again; flush()
+// (or the next receive()) submits them all with one syscall. Where the slab
+// cannot be registered (RLIMIT_MEMLOCK) or SEND_ZC is missing, sends go out
+// as IORING_OP_SENDMSG from the same slab.
+//
+// Without io_uring or multishot receives (kernels before 6.0, seccomp
+// filters), available() is false and the same calls go through
+// UDPSocket::receiveBatch() and UDPSocket::send().
+//
+//     UDPRing ring(socket);
+//     ring.receive([&](const void* data, size_t size, const Address& src) { ... }, true);
+//     ring.send(reply, reply_size, src);
+//     ring.flush();
+class UDPRing {
+public:
+    // 'buffers' is rounded up to a power of two, at most 32768. Each buffer
+    // starts with a 44 byte header for the source address; longer datagrams
+    // than the rest are truncated, as with receive().
+    UDPRing(UDPSocket& socket, unsigned buffers = 1024, unsigned buffer_size = 2048, unsigned send_slots = 256);
+    ~UDPRing();
+
+    UDPRing(const UDPRing&) = delete;
+    UDPRing& operator=(const UDPRing&) = delete;
+
+    bool available() const { return ring_fd_ >= 0; }
+
+    // Calls handler(data, size, src) for every datagram received so far; with
+    // 'wait', first blocks until there is at least one (on a non-blocking
+    // socket the fallback path does not wait).
+    // Returns the number of datagrams handled.
+    template<typename Handler>
+    int receive(const Handler& handler, bool wait = false);
+
+    // Queues 'size' bytes to 'dst'; the data is copied, so it may be reused
+    // right away. Waits for earlier sends when all slots are in flight.
+    // Returns the number of bytes queued, 0 if it is too large or dst invalid.
+    int send(const void* data, size_t size, Address dst);
+
+    // Submits the queued sends
+    void flush();
+
+private:
+    static constexpr uint64_t RECV_TAG = ~uint64_t(0);
+    static constexpr uint16_t BUFFER_GROUP = 0;
+
+    struct SendSlot {
+        msghdr header;
+        iovec data;
+        sockaddr_storage address;
+    };
+
+    bool setup(unsigned send_slots);
+    void teardown();
+    // Switches to receiveBatch() / send()
+    void useFallback();
+
+    io_uring_sqe* nextSqe();
+    void armReceive();
+    int enter(unsigned min_complete);
+    void recycle(uint16_t bid);
+    void publishBuffers();
+    // Registers the send slab as fixed buffer 0 if SEND_ZC is supported
+    bool registerSendSlab(size_t size);
+    void sendDone(const io_uring_cqe& cqe);
+    // Calls handler for the datagram of a receive completion; returns false
+    // if it has none
+    template<typename Handler>
+    bool received(const io_uring_cqe& cqe, const Handler& handler);
+    // Waits until 'count' send slots are free; receives completed meanwhile
+    // are kept for the next receive()
+    void waitForSlots(size_t count);
+
+    UDPSocket& socket_;
+    int ring_fd_ = -1;
+
+    // submission queue
+    void* sq_map_ = nullptr;
+    size_t sq_map_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned sq_local_tail_ = 0;
+    unsigned to_submit_ = 0;
+
+    // completion queue
+    void* cq_map_ = nullptr;
+    size_t cq_map_size_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    // provided receive buffers
+    io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    unsigned buf_count_ = 0;
+    uint16_t buf_tail_ = 0;
+    unsigned buf_pending_ = 0; // recycled but not yet published
+    unsigned buffer_size_ = 0;
+    char* buffers_ = nullptr;
+    msghdr recv_header_;
+    bool receive_armed_ = false;
+    bool multishot_unsupported_ = false;
+    std::vector<io_uring_cqe> deferred_;
+
+    // send slab
+    std::vector<SendSlot> send_slots_;
+    std::vector<uint32_t> free_slots_;
+    char* send_data_ = nullptr;
+    bool fixed_sends_ = false;
+
+    // fallback path
+    std::vector<char> fallback_data_;
+    std::vector<void*> fallback_buffers_;
+    std::vector<size_t> fallback_sizes_;
+    std::vector<Address> fallback_sources_;
+};
+
+inline UDPRing::UDPRing(UDPSocket& socket, unsigned buffers, unsigned buffer_size, unsigned send_slots)
+    : socket_(socket), buffer_size_(buffer_size) {
+    assert(buffer_size > sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in6));
+    buf_count_ = 1;
+    while (buf_count_ < buffers && buf_count_ < 32768) buf_count_ <<= 1;
+
+    if (!setup(send_slots)) {
+        useFallback();
+        return;
+    }
+
+    send_slots_.resize(send_slots);
+    free_slots_.reserve(send_slots);
+    for (unsigned i = send_slots; i-- > 0;) free_slots_.push_back(i);
+    armReceive();
+    enter(0);
+}
+
+inline UDPRing::~UDPRing() {
+    // the kernel may still read the slots of unfinished sends
+    if (available()) waitForSlots(send_slots_.size());
+    teardown();
+}
+
+inline void UDPRing::useFallback() {
+    teardown();
+    const int batch = NET_MAX_BATCH;
+    fallback_data_.resize(size_t(batch) * buffer_size_);
+    fallback_buffers_.resize(batch);
+    fallback_sizes_.resize(batch);
+    fallback_sources_.resize(batch);
+    for (int i = 0; i < batch; ++i) fallback_buffers_[i] = &fallback_data_[size_t(i) * buffer_size_];
+}
+
+inline bool UDPRing::setup(unsigned send_slots) {
+    // every buffer can hold a completion, plus two (the result and the
+    // zero-copy notification) for each send in flight
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = buf_count_ + 2 * send_slots;
+    ring_fd_ = (int)syscall(__NR_io_uring_setup, send_slots < 64 ? 64 : send_slots, &params);
+    if (ring_fd_ < 0) {
+        printf("io_uring unavailable (%s), using recvmmsg\n", strerror(errno));
+        return false;
+    }
+
+    sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_map_size_ > sq_map_size_) sq_map_size_ = cq_map_size_;
+        cq_map_size_ = 0;
+    }
+    sq_map_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_map_ == MAP_FAILED) return false;
+    if (cq_map_size_) {
+        cq_map_ = mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_map_ == MAP_FAILED) return false;
+    }
+    char* sq = (char*)sq_map_;
+    char* cq = cq_map_size_ ? (char*)cq_map_ : sq;
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe*)mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) return false;
+
+    sq_head_ = (unsigned*)(sq + params.sq_off.head);
+    sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask_ = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array_ = (unsigned*)(sq + params.sq_off.array);
+    sq_local_tail_ = *sq_tail_;
+    cq_head_ = (unsigned*)(cq + params.cq_off.head);
+    cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask_ = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // receive buffers and the ring that hands them to the kernel
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    buf_ring_size_ = (buf_count_ * sizeof(io_uring_buf) + page - 1) & ~(page - 1);
+    buf_ring_ = (io_uring_buf_ring*)mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring_ == MAP_FAILED) {
+        buf_ring_ = nullptr;
+        return false;
+    }
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buf_ring_;
+    reg.ring_entries = buf_count_;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        printf("io_uring buffer rings unavailable (%s), using recvmmsg\n", strerror(errno));
+        return false;
+    }
+
+    buffers_ = (char*)aligned_alloc(page, ((size_t(buf_count_) * buffer_size_) + page - 1) & ~(page - 1));
+    const size_t send_size = ((size_t(buffer_size_) * send_slots) + page - 1) & ~(page - 1);
+    send_data_ = (char*)aligned_alloc(page, send_size);
+    if (!buffers_ || !send_data_) return false;
+    fixed_sends_ = registerSendSlab(send_size);
+    for (unsigned i = 0; i < buf_count_; ++i) recycle(uint16_t(i));
+    publishBuffers();
+
+    // the layout of every received buffer: io_uring_recvmsg_out, the source
+    // address, then the payload
+    memset(&recv_header_, 0, sizeof(recv_header_));
+    recv_header_.msg_namelen = sizeof(sockaddr_in6);
+    return true;
+}
+
+inline void UDPRing::teardown() {
+    if (ring_fd_ >= 0) close(ring_fd_);
+    ring_fd_ = -1;
+    if (sqes_ && sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+    if (cq_map_ && cq_map_ != MAP_FAILED) munmap(cq_map_, cq_map_size_);
+    if (sq_map_ && sq_map_ != MAP_FAILED) munmap(sq_map_, sq_map_size_);
+    if (buf_ring_) munmap(buf_ring_, buf_ring_size_);
+    free(buffers_);
+    free(send_data_);
+    sqes_ = nullptr;
+    cq_map_ = sq_map_ = nullptr;
+    buf_ring_ = nullptr;
+    buffers_ = send_data_ = nullptr;
+}
+
+inline io_uring_sqe* UDPRing::nextSqe() {
+    // the queue is full: hand what is there to the kernel first
+    if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) > sq_mask_) enter(0);
+
+    const unsigned index = sq_local_tail_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sq_local_tail_;
+    ++to_submit_;
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+inline void UDPRing::armReceive() {
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = int(socket_.getHandle());
+    sqe->addr = (uint64_t)(uintptr_t)&recv_header_;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = RECV_TAG;
+    receive_armed_ = true;
+}
+
+inline int UDPRing::enter(unsigned min_complete) {
+    const unsigned submit = to_submit_;
+    to_submit_ = 0;
+    if (!submit && !min_complete) return 0;
+    const unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int result;
+    do {
+        result = (int)syscall(__NR_io_uring_enter, ring_fd_, submit, min_complete, flags, nullptr, 0);
+    } while (result < 0 && errno == EINTR);
+    return result;
+}
+
+inline void UDPRing::recycle(uint16_t bid) {
+    // not buf_ring_->bufs: in C++ the empty struct in front of it moves it
+    // off the kernel's layout
+    io_uring_buf& buf = ((io_uring_buf*)buf_ring_)[(buf_tail_ + buf_pending_) & (buf_count_ - 1)];
+    buf.addr = (uint64_t)(uintptr_t)(buffers_ + size_t(bid) * buffer_size_);
+    buf.len = buffer_size_;
+    buf.bid = bid;
+    ++buf_pending_;
+}
+
+inline void UDPRing::publishBuffers() {
+    buf_tail_ = uint16_t(buf_tail_ + buf_pending_);
+    buf_pending_ = 0;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+inline bool UDPRing::registerSendSlab(size_t size) {
+    std::vector<char> memory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = (io_uring_probe*)memory.data();
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe, 256) != 0) return false;
+    const io_uring_probe_op* ops = (const io_uring_probe_op*)(memory.data() + sizeof(io_uring_probe));
+    if (probe->ops_len <= IORING_OP_SEND_ZC || !(ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED)) return false;
+
+    iovec slab;
+    slab.iov_base = send_data_;
+    slab.iov_len = size;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, &slab, 1) != 0) {
+        printf("io_uring send buffers not registered (%s), using sendmsg\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+inline void UDPRing::sendDone(const io_uring_cqe& cqe) {
+    // a zero-copy send completes twice: with its result, then, flagged
+    // IORING_CQE_F_NOTIF, once the kernel is done with the slot
+    if (!(cqe.flags & IORING_CQE_F_NOTIF)) {
+        if (cqe.res < 0) printf("Failed to send data (%s)\n", strerror(-cqe.res));
+        if (cqe.flags & IORING_CQE_F_MORE) return;
+    }
+    free_slots_.push_back(uint32_t(cqe.user_data));
+}
+
+template<typename Handler>
+bool UDPRing::received(const io_uring_cqe& cqe, const Handler& handler) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) receive_armed_ = false;
+    if (cqe.res < 0) {
+        // -ENOBUFS: every buffer was in use; receive() rearms
+        if (cqe.res == -EINVAL) multishot_unsupported_ = true;
+        else if (cqe.res != -ENOBUFS) printf("io_uring receive failed (%s)\n", strerror(-cqe.res));
+        return false;
+    }
+
+    const uint16_t bid = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    const char* buffer = buffers_ + size_t(bid) * buffer_size_;
+    const io_uring_recvmsg_out* out = (const io_uring_recvmsg_out*)buffer;
+    const size_t offset = sizeof(io_uring_recvmsg_out) + recv_header_.msg_namelen + recv_header_.msg_controllen;
+    size_t size = size_t(cqe.res) - offset;
+    if (out->payloadlen < size) size = out->payloadlen;
+
+    sockaddr_storage from;
+    memset(&from, 0, sizeof(from));
+    memcpy(&from, buffer + sizeof(io_uring_recvmsg_out), out->namelen < sizeof(from) ? out->namelen : sizeof(from));
+    Address src;
+    net_detail::toAddress(from, &src);
+
+    handler((const void*)(buffer + offset), size, src);
+    recycle(bid);
+    return true;
+}
+
+template<typename Handler>
+int UDPRing::receive(const Handler& handler, bool wait) {
+    if (!available()) {
+        // with 'wait', a blocking socket waits inside receiveBatch()
+        const int n = socket_.receiveBatch(fallback_buffers_.data(), buffer_size_, fallback_sizes_.data(),
+                                           fallback_sources_.data(), NET_MAX_BATCH);
+        for (int i = 0; i < n; ++i) handler((const void*)fallback_buffers_[i], fallback_sizes_[i], fallback_sources_[i]);
+        return n;
+    }
+
+    int count = 0;
+    for (const io_uring_cqe& cqe : deferred_) count += received(cqe, handler);
+    deferred_.clear();
+
+    unsigned head = *cq_head_;
+    if (!count && head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) && (wait || to_submit_)) enter(wait ? 1 : 0);
+
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        if (cqe.user_data == RECV_TAG) count += received(cqe, handler);
+        else sendDone(cqe);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    if (multishot_unsupported_) {
+        printf("io_uring multishot receive unavailable, using recvmmsg\n");
+        waitForSlots(send_slots_.size());
+        useFallback();
+        return count;
+    }
+    if (buf_pending_) publishBuffers();
+    if (!receive_armed_) armReceive();
+    if (to_submit_) enter(0);
+    return count;
+}
+
+inline int UDPRing::send(const void* data, size_t size, Address dst) {
+    if (!available()) return socket_.send(data, size, dst);
+    if (size > buffer_size_) return 0;
+
+    if (free_slots_.empty()) waitForSlots(1);
+    const uint32_t slot_index = free_slots_.back();
+    SendSlot& slot = send_slots_[slot_index];
+    const size_t addr_length = net_detail::toSockaddr(dst, slot.address);
+    if (!addr_length) return 0;
+    free_slots_.pop_back();
+
+    char* bytes = send_data_ + size_t(slot_index) * buffer_size_;
+    memcpy(bytes, data, size);
+
+    io_uring_sqe* sqe = nextSqe();
+    sqe->fd = int(socket_.getHandle());
+    sqe->user_data = slot_index;
+    if (fixed_sends_) {
+        sqe->opcode = IORING_OP_SEND_ZC;
+        sqe->addr = (uint64_t)(uintptr_t)bytes;
+        sqe->len = unsigned(size);
+        sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+        sqe->buf_index = 0;
+        sqe->addr2 = (uint64_t)(uintptr_t)&slot.address;
+        sqe->addr_len = uint16_t(addr_length);
+        return int(size);
+    }
+
+    slot.data.iov_base = bytes;
+    slot.data.iov_len = size;
+    memset(&slot.header, 0, sizeof(slot.header));
+    slot.header.msg_name = &slot.address;
+    slot.header.msg_namelen = socklen_t(addr_length);
+    slot.header.msg_iov = &slot.data;
+    slot.header.msg_iovlen = 1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uint64_t)(uintptr_t)&slot.header;
+    sqe->len = 1;
+    return int(size);
+}
+
+inline void UDPRing::flush() {
+    if (available()) enter(0);
+}
+
+inline void UDPRing::waitForSlots(size_t count) {
+    while (free_slots_.size() < count) {
+        enter(1);
+        unsigned head = *cq_head_;
+        const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            if (cqe.user_data == RECV_TAG) deferred_.push_back(cqe);
+            else sendDone(cqe);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+}
+
+#endif // __linux__
+
+#endif // URING_H
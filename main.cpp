@@ -4,6 +4,9 @@
 #include <vector>
 #include <math/matrix.h>
 #include <math/math.h>
+#include <math/dense_matrix.h>
+#include <math/fast_math.h>
+#include <math/segments.h>
 #include "humanize/time.h"
 #include "misc./log.h"
 #include "misc./color.h"
@@ -12,6 +15,9 @@
 #include "misc./array_util.h"
 #include "misc./monte_carlo.h"
 #include "network/net.h"
+#include "network/packet_pool.h"
+#include "network/server.h"
+#include "network/uring.h"
 
 #ifdef THREADS
 #include <thread>
@@ -19,6 +25,372 @@
 #include <atomic>
 #endif
 
+// Compile checks: integer vectors keep taking floating-point scalars and
+// convert the result back, as operator*(vec_t, float) did
+static_assert((Vector3i(3, 3, 3) * 2.5f)[0] == 7, "Vector3i * float");
+static_assert((2.5f * Vector3i(3, 3, 3))[0] == 7, "float * Vector3i");
+static_assert((Vector3i(3, 3, 3) / 2.0f)[0] == 1, "Vector3i / float");
+
+inline Vector3i compileCheckIntVector(Vector3i a) {
+    a *= 2.0f;
+    a /= 2.0f;
+    return m_normalize(a) + a * 2.5f;
+}
+
+#ifdef BENCHMARK
+// Prints how many samples/sec 'simulate' gets through for 'n' samples
+template<typename Simulate>
+static void benchSamples(const char* name, std::size_t n, Simulate simulate) {
+    double start = getCurrentTime();
+    double estimate = simulate(n);
+    double secs = getCurrentTime() - start;
+    printf("%-24s %.6f  %8.2f Msamples/s\n", name, estimate, n / secs * 1e-6);
+}
+
+static void benchMonteCarlo() {
+    const std::size_t n = 1e8;
+
+    MonteCarlo<double> mc([] (const std::function<double()>& rng) -> double {
+        auto x = rng(), y = rng();
+        return x * x + y * y <= 1.0 ? 1.0 : 0.0;
+    });
+    auto mct = makeMonteCarlo([] (auto& rng) -> double {
+        auto x = rng(), y = rng();
+        return x * x + y * y <= 1.0 ? 1.0 : 0.0;
+    });
+
+    benchSamples("MonteCarlo", n, [&] (std::size_t n) { return 4*mc.simulate(n); });
+    benchSamples("MonteCarloT", n, [&] (std::size_t n) { return 4*mct.simulate(n); });
+
+    // Batched kernels over 8 and 16 lanes
+    auto batch8 = makeMonteCarloBatch<2, 8>([] (const double (&u)[2][8], double (&out)[8]) {
+        for(int l = 0; l < 8; ++l) out[l] = u[0][l] * u[0][l] + u[1][l] * u[1][l] <= 1.0 ? 1.0 : 0.0;
+    });
+    auto batch16 = makeMonteCarloBatch<2, 16>([] (const double (&u)[2][16], double (&out)[16]) {
+        for(int l = 0; l < 16; ++l) out[l] = u[0][l] * u[0][l] + u[1][l] * u[1][l] <= 1.0 ? 1.0 : 0.0;
+    });
+
+    benchSamples("MonteCarloBatch<8>", n, [&] (std::size_t n) { return 4*batch8.simulate(n); });
+    benchSamples("MonteCarloBatch<16>", n, [&] (std::size_t n) { return 4*batch16.simulate(n); });
+}
+
+// Raw 64-bit outputs/sec of an engine and getDouble() calls/sec through BasicRNG
+template<typename Engine>
+static void benchEngine(const char* name, std::size_t n) {
+    Engine engine(std::random_device{}());
+    std::uint64_t sink = 0;
+    double start = getCurrentTime();
+    for(std::size_t i = 0; i < n; ++i) sink ^= engine();
+    double raw = getCurrentTime() - start;
+
+    BasicRNG<Engine> rng;
+    double sum = 0;
+    start = getCurrentTime();
+    for(std::size_t i = 0; i < n; ++i) sum += rng.getDouble();
+    double dbl = getCurrentTime() - start;
+
+    printf("%-20s %8.1f M/s (%5.2f GB/s)  getDouble %8.1f M/s  [%llx %.1f]\n", name,
+           n / raw * 1e-6, n * sizeof(typename Engine::result_type) / raw * 1e-9,
+           n / dbl * 1e-6, (unsigned long long)sink, sum);
+}
+
+static void benchEngines() {
+    const std::size_t n = 2e8;
+    benchEngine<std::mt19937>("std::mt19937", n);
+    benchEngine<std::mt19937_64>("std::mt19937_64", n);
+    benchEngine<Xoshiro256StarStar>("xoshiro256**", n);
+    benchEngine<PCG64>("PCG64", n);
+    benchEngine<SplitMix64>("SplitMix64", n);
+}
+
+// GB/s written by 'fill' into a buffer of n values of T
+template<typename T, typename Fill>
+static void benchFill(const char* name, std::vector<T>& buffer, std::size_t bytes, Fill fill) {
+    double start = getCurrentTime();
+    fill(buffer.data(), buffer.size());
+    double secs = getCurrentTime() - start;
+    printf("%-22s %6.2f GB/s\n", name, bytes / secs * 1e-9);
+}
+
+static void benchBulkFill() {
+    const std::size_t n = 1 << 27;
+    RNG rng;
+    std::vector<float> floats(n);
+    std::vector<double> doubles(n);
+    std::vector<int> ints(n);
+    std::vector<std::uint64_t> bits(n / 64);
+
+    benchFill("getFloat loop", floats, n * sizeof(float), [&] (float* out, std::size_t n) {
+        for(std::size_t i = 0; i < n; ++i) out[i] = rng.getFloat();
+    });
+    benchFill("fillFloats", floats, n * sizeof(float), [&] (float* out, std::size_t n) { rng.fillFloats(out, n); });
+    benchFill("fillDoubles", doubles, n * sizeof(double), [&] (double* out, std::size_t n) { rng.fillDoubles(out, n); });
+    benchFill("fillInts", ints, n * sizeof(int), [&] (int* out, std::size_t n) { rng.fillInts(out, n); });
+    benchFill("fillBools (n bits)", bits, n / 8, [&] (std::uint64_t* out, std::size_t words) {
+        rng.fillBools(out, words * 64);
+    });
+}
+
+// GFLOP/s of an n x n x n product computed by 'multiply'
+template<typename Multiply>
+static void benchMultiply(const char* name, std::size_t n, Multiply multiply) {
+    double start = getCurrentTime();
+    multiply();
+    double secs = getCurrentTime() - start;
+    printf("%-22s n=%-5zu %7.2f GFLOP/s\n", name, n, 2.0 * n * n * n / secs * 1e-9);
+}
+
+static void benchGemm() {
+    RNG rng;
+    for(std::size_t n : {256, 512, 1024, 2048}) {
+        DenseMatrix<float> a(n, n), b(n, n), c(n, n);
+        rng.fillFloats(a.data(), a.size());
+        rng.fillFloats(b.data(), b.size());
+
+        // the naive loop takes minutes beyond n = 1024
+        if(n <= 1024) {
+            benchMultiply("naive loop", n, [&] {
+                for(std::size_t col = 0; col < n; ++col)
+                    for(std::size_t row = 0; row < n; ++row) {
+                        float sum = 0;
+                        for(std::size_t i = 0; i < n; ++i) sum += a(row, i) * b(i, col);
+                        c(row, col) = sum;
+                    }
+            });
+        }
+        benchMultiply("gemm 1 thread", n, [&] { gemm(1.0f, a, b, 0.0f, c, 1); });
+        benchMultiply("gemm all threads", n, [&] { gemm(1.0f, a, b, 0.0f, c); });
+    }
+}
+
+// Max ulp error against double libm and Mvalues/s of 'f' over 'in'
+template<typename Reference, typename F>
+static void benchFunction(const char* name, const std::vector<float>& in, std::vector<float>& out,
+                          Reference reference, F f) {
+    double start = getCurrentTime();
+    f(in.data(), out.data(), in.size());
+    double secs = getCurrentTime() - start;
+
+    double maxUlp = 0;
+    for(std::size_t i = 0; i < in.size(); ++i) {
+        const double exact = reference(in[i]);
+        int e;
+        std::frexp(float(exact), &e);
+        maxUlp = std::max(maxUlp, std::fabs(out[i] - exact) / std::ldexp(1.0, std::max(e - 24, -149)));
+    }
+    printf("%-26s %10.2f ulp  %8.1f M/s\n", name, maxUlp, in.size() / secs * 1e-6);
+}
+
+// Same, for the array forms of fast_math.h, which are overloaded with the scalar ones
+template<typename Reference>
+static void benchFunction(const char* name, const std::vector<float>& in, std::vector<float>& out,
+                          Reference reference, void (*f)(const float*, float*, std::size_t)) {
+    benchFunction<Reference, decltype(f)>(name, in, out, reference, f);
+}
+
+// Runs a one-float function over an array, for the functions without array forms
+template<typename F>
+static auto eachFloat(F f) {
+    return [f] (const float* in, float* out, std::size_t n) {
+        for(std::size_t i = 0; i < n; ++i) out[i] = f(in[i]);
+    };
+}
+
+static void benchFastMath() {
+    using simd::Accuracy;
+    const std::size_t n = 1 << 24;
+    RNG rng;
+    std::vector<float> angles(n), exponents(n), positive(n), out(n);
+    for(std::size_t i = 0; i < n; ++i) {
+        angles[i] = rng.getFloat() * 6.28318531f - 3.14159265f;
+        exponents[i] = rng.getFloat() * 160.0f - 80.0f;
+        positive[i] = rng.getFloat() * 100.0f + 1e-3f;
+    }
+
+    auto sin = [] (float x) { return std::sin(double(x)); };
+    benchFunction("std::sin", angles, out, sin, eachFloat([] (float x) { return std::sin(x); }));
+    benchFunction("Math::fSin", angles, out, sin, eachFloat([] (float x) { return Math::fSin(x); }));
+    benchFunction("fastSin scalar", angles, out, sin, eachFloat([] (float x) { return Math::fastSin(x); }));
+    benchFunction("fastSin<Precise>", angles, out, sin, Math::fastSin<Accuracy::Precise>);
+    benchFunction("fastSin<Fast>", angles, out, sin, Math::fastSin<Accuracy::Fast>);
+
+    auto cos = [] (float x) { return std::cos(double(x)); };
+    benchFunction("std::cos", angles, out, cos, eachFloat([] (float x) { return std::cos(x); }));
+    benchFunction("Math::fCos", angles, out, cos, eachFloat([] (float x) { return Math::fCos(x); }));
+    benchFunction("fastCos<Precise>", angles, out, cos, Math::fastCos<Accuracy::Precise>);
+    benchFunction("fastCos<Fast>", angles, out, cos, Math::fastCos<Accuracy::Fast>);
+
+    auto exp = [] (float x) { return std::exp(double(x)); };
+    benchFunction("std::exp", exponents, out, exp, eachFloat([] (float x) { return std::exp(x); }));
+    benchFunction("fastExp<Precise>", exponents, out, exp, Math::fastExp<Accuracy::Precise>);
+    benchFunction("fastExp<Fast>", exponents, out, exp, Math::fastExp<Accuracy::Fast>);
+
+    auto log = [] (float x) { return std::log(double(x)); };
+    benchFunction("std::log", positive, out, log, eachFloat([] (float x) { return std::log(x); }));
+    benchFunction("fastLog<Precise>", positive, out, log, Math::fastLog<Accuracy::Precise>);
+    benchFunction("fastLog<Fast>", positive, out, log, Math::fastLog<Accuracy::Fast>);
+
+    // atan2(x, 1 - x), so that one input array drives it
+    std::vector<float> other(n);
+    for(std::size_t i = 0; i < n; ++i) other[i] = 1.0f - angles[i];
+    auto atan2 = [] (float x) { return std::atan2(double(x), double(1.0f - x)); };
+    benchFunction("std::atan2", angles, out, atan2, eachFloat([] (float x) { return std::atan2(x, 1.0f - x); }));
+    benchFunction("fastAtan2<Precise>", angles, out, atan2, [&] (const float* in, float* o, std::size_t n) {
+        Math::fastAtan2<Accuracy::Precise>(in, other.data(), o, n);
+    });
+    benchFunction("fastAtan2<Fast>", angles, out, atan2, [&] (const float* in, float* o, std::size_t n) {
+        Math::fastAtan2<Accuracy::Fast>(in, other.data(), o, n);
+    });
+}
+
+// Random segments of up to 'length' in a 'size' x 'size' square
+static Segments2f randomSegments(RNG& rng, std::size_t n, float size, float length) {
+    Segments2f s;
+    s.reserve(n);
+    for(std::size_t i = 0; i < n; ++i) {
+        const float x = rng.getFloat() * size, y = rng.getFloat() * size;
+        s.push_back(Vector4f(x, y, x + (rng.getFloat() - 0.5f) * length, y + (rng.getFloat() - 0.5f) * length));
+    }
+    return s;
+}
+
+static void benchSegments() {
+    RNG rng;
+    for(std::size_t n : {10000, 30000, 1000000}) {
+        const Segments2f s = randomSegments(rng, n, 10000.0f, 100.0f);
+
+        // all pairs with doIntersect takes minutes beyond n = 30000
+        if(n <= 30000) {
+            double start = getCurrentTime();
+            std::size_t found = 0;
+            for(std::size_t i = 0; i < n; ++i) {
+                const Vector4f a = s.get(i);
+                for(std::size_t j = i + 1; j < n; ++j) {
+                    const Vector4f b = s.get(j);
+                    found += Math::doIntersect(Vector2f(a.x, a.y), Vector2f(b.x, b.y), Vector2f(a.z, a.w), Vector2f(b.z, b.w));
+                }
+            }
+            printf("doIntersect all pairs  n=%-8zu %8zu pairs %9.4f s\n", n, found, getCurrentTime() - start);
+        }
+        double start = getCurrentTime();
+        const std::size_t found = Math::findIntersections(s).size();
+        printf("findIntersections      n=%-8zu %8zu pairs %9.4f s\n", n, found, getCurrentTime() - start);
+    }
+}
+
+// Loopback packets/sec, sending 'count' 64-byte datagrams in rounds of
+// NET_MAX_BATCH and receiving each round before the next
+template<typename Round>
+static void benchPackets(const char* name, int count, Round round) {
+    double start = getCurrentTime();
+    int received = 0;
+    for(int i = 0; i < count; i += NET_MAX_BATCH) received += round();
+    double secs = getCurrentTime() - start;
+    printf("%-28s %9.0f packets/s (%d/%d received)\n", name, received / secs, received, count);
+}
+
+static void benchUDP() {
+    const int count = 1 << 20;
+    const uint16_t port = 47810;
+    UDPSocket sender(uint16_t(port + 1), true, AF_INET);
+    UDPSocket receiver(port, true, AF_INET);
+
+    Address to = {};
+    to.type = Address::Type::IPv4;
+    to.ipv4 = htonl(INADDR_LOOPBACK);
+    to.port = htons(port);
+
+    char packets[NET_MAX_BATCH][64] = {};
+    char buffers[NET_MAX_BATCH][2048];
+    const void* send_ptrs[NET_MAX_BATCH];
+    void* receive_ptrs[NET_MAX_BATCH];
+    size_t sizes[NET_MAX_BATCH], received_sizes[NET_MAX_BATCH];
+    Address targets[NET_MAX_BATCH], sources[NET_MAX_BATCH];
+    for(int i = 0; i < NET_MAX_BATCH; ++i) {
+        send_ptrs[i] = packets[i];
+        receive_ptrs[i] = buffers[i];
+        sizes[i] = sizeof(packets[i]);
+        targets[i] = to;
+    }
+
+    benchPackets("send / receive", count, [&] {
+        for(int i = 0; i < NET_MAX_BATCH; ++i) sender.send(packets[i], sizeof(packets[i]), to);
+        int n = 0;
+        while(n < NET_MAX_BATCH && receiver.receive(buffers[n], sizeof(buffers[n]), &sources[n]) > 0) ++n;
+        return n;
+    });
+    benchPackets("sendBatch / receiveBatch", count, [&] {
+        sender.sendBatch(send_ptrs, sizes, targets, NET_MAX_BATCH);
+        return receiver.receiveBatch(receive_ptrs, sizeof(buffers[0]), received_sizes, sources, NET_MAX_BATCH);
+    });
+
+    PacketPool pool(4 * NET_MAX_BATCH);
+    PacketRef received[NET_MAX_BATCH];
+    benchPackets("sendBatch / PacketPool", count, [&] {
+        sender.sendBatch(send_ptrs, sizes, targets, NET_MAX_BATCH);
+        return pool.receive(receiver, received, NET_MAX_BATCH);
+    });
+
+#ifdef __linux__
+    UDPRing sender_ring(sender), receiver_ring(receiver);
+    benchPackets(receiver_ring.available() ? "UDPRing (io_uring)" : "UDPRing (fallback)", count, [&] {
+        for(int i = 0; i < NET_MAX_BATCH; ++i) sender_ring.send(packets[i], sizeof(packets[i]), to);
+        sender_ring.flush();
+        return receiver_ring.receive([] (const void*, size_t, const Address&) {});
+    });
+#endif
+}
+
+#ifdef __linux__
+// Loopback load on a UDPServer: a sending thread per worker for a second,
+// with one worker and with one per core
+static void benchServer() {
+    const uint16_t port = 47820;
+    for(unsigned requested : {1u, 0u}) {
+        UDPServer server(port, AF_INET, requested);
+        const unsigned workers = server.workers();
+        // a single usable core: the second run would repeat the first
+        if(requested == 0 && workers == 1) break;
+        server.start([] (unsigned, UDPSocket&, PacketRef*, int) {});
+
+        std::atomic<bool> done{false};
+        std::atomic<long> sent{0};
+        std::vector<std::thread> senders;
+        const double start = getCurrentTime();
+        for(unsigned t = 0; t < workers; ++t) {
+            senders.emplace_back([&, t] {
+                UDPSocket sender(uint16_t(port + 1 + t), true, AF_INET);
+                Address to = {};
+                to.type = Address::Type::IPv4;
+                to.ipv4 = htonl(INADDR_LOOPBACK);
+                to.port = htons(port);
+
+                char packet[64] = {};
+                const void* buffers[NET_MAX_BATCH];
+                size_t sizes[NET_MAX_BATCH];
+                Address targets[NET_MAX_BATCH];
+                for(int i = 0; i < NET_MAX_BATCH; ++i) {
+                    buffers[i] = packet;
+                    sizes[i] = sizeof(packet);
+                    targets[i] = to;
+                }
+                while(!done) sent += sender.sendBatch(buffers, sizes, targets, NET_MAX_BATCH);
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        done = true;
+        for(auto& sender : senders) sender.join();
+        const double secs = getCurrentTime() - start;
+        server.stop();
+
+        long received = 0;
+        for(unsigned w = 0; w < server.workers(); ++w) received += long(server.received(w));
+        printf("UDPServer, %2u workers %s %9.0f packets/s (%ld/%ld received)\n", workers,
+               server.steered() ? "(cpu)" : "(hash)", received / secs, received, sent.load());
+    }
+}
+#endif
+#endif
 
 int main() {
     // Sampling function. Provides a callable random number generator
@@ -38,5 +410,26 @@ int main() {
 
     // Apply 5 *10 ^ times.
     MEASURE_TIME(printf("%.6f\n", 4*pi_estimator.simulate(5e8)));
+
+#ifdef THREADS
+    // Same estimate split over every core. With a fixed seed the result
+    // is identical for any thread count.
+    pi_estimator.setSeed(42);
+    MEASURE_TIME(printf("%.6f\n", 4*pi_estimator.simulate(5e8, std::thread::hardware_concurrency())));
+    MEASURE_TIME(printf("%.6f\n", 4*pi_estimator.simulate(5e8, 1)));
+#endif
+
+#ifdef BENCHMARK
+    benchMonteCarlo();
+    benchEngines();
+    benchBulkFill();
+    benchGemm();
+    benchFastMath();
+    benchSegments();
+    benchUDP();
+#ifdef __linux__
+    benchServer();
+#endif
+#endif
   return 0;
 }